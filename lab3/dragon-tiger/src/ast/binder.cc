@@ -59,13 +59,21 @@ Binder::Binder() : scopes() {
   enter_primitive("print_int", "void", {"int"});
   enter_primitive("flush", "void", {});
   enter_primitive("getchar", "string", {});
+  enter_primitive("read_line", "string", {});
+  enter_primitive("read_all", "string", {});
+  enter_primitive("clock_ns", "int", {});
+  enter_primitive("cycles", "int", {});
   enter_primitive("ord", "int", {"string"});
+  enter_primitive("char_at", "int", {"string", "int"});
   enter_primitive("chr", "string", {"int"});
+  enter_primitive("int_to_string", "string", {"int"});
+  enter_primitive("string_to_int", "int", {"string"});
   enter_primitive("size", "int", {"string"});
   enter_primitive("substring", "string", {"string", "int", "int"});
   enter_primitive("concat", "string", {"string", "string"});
   enter_primitive("strcmp", "int", {"string", "string"});
   enter_primitive("streq", "int", {"string", "string"});
+  enter_primitive("intern", "string", {"string"});
   enter_primitive("not", "int", {"int"});
   enter_primitive("exit", "void", {"int"});
 }
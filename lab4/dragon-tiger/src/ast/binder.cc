@@ -0,0 +1,277 @@
+#include <sstream>
+
+// Also built by lab6, against its own headers: they are found through
+// the include path rather than next to this file.
+#include "ast/binder.hh"
+#include "utils/errors.hh"
+#include "utils/nolocation.hh"
+
+using utils::error;
+using utils::non_fatal_error;
+
+namespace ast {
+namespace binder {
+
+/* Returns the current scope */
+scope_t &Binder::current_scope() { return scopes.back(); }
+
+/* Pushes a new scope on the stack */
+void Binder::push_scope() { scopes.push_back(scope_t()); }
+
+/* Pops the current scope from the stack */
+void Binder::pop_scope() { scopes.pop_back(); }
+
+/* Enter a declaration in the current scope. Raises an error if the declared name
+ * is already defined */
+void Binder::enter(Decl &decl) {
+  scope_t &scope = current_scope();
+  auto previous = scope.find(decl.name);
+  if (previous != scope.end()) {
+    non_fatal_error(decl.loc,
+                    decl.name.get() + " is already defined in this scope");
+    error(previous->second->loc, "previous declaration was here");
+  }
+  scope[decl.name] = &decl;
+}
+
+/* Enter a variable declaration in the current scope, at the depth of the
+ * function being analyzed */
+void Binder::enter_variable(VarDecl &decl) {
+  decl.set_depth(depth);
+  enter(decl);
+}
+
+/* Finds the declaration for a given name. The scope stack is traversed
+ * front to back starting from the current scope. The first matching
+ * declaration is returned. Raises an error, if no declaration matches. */
+Decl &Binder::find(const location loc, const Symbol &name) {
+  for (auto scope = scopes.crbegin(); scope != scopes.crend(); scope++) {
+    auto decl_entry = scope->find(name);
+    if (decl_entry != scope->cend()) {
+      return *decl_entry->second;
+    }
+  }
+  error(loc, name.get() + " cannot be found in this scope");
+}
+
+/* Binds an identifier to the variable it denotes. A variable used from a
+ * function nested in the one declaring it escapes. */
+void Binder::resolve(Identifier &id) {
+  VarDecl *decl = dynamic_cast<VarDecl *>(&find(id.loc, id.name));
+  if (!decl)
+    error(id.loc,
+          id.name.get() + " does not denote a variable in the current context");
+  id.set_decl(decl);
+  id.set_depth(depth);
+  if (depth > decl->get_depth())
+    decl->set_escapes();
+}
+
+/* The depth is the number of functions enclosing the code being analyzed,
+ * not counting main, so it is only valid once main is entered */
+Binder::Binder() : depth(-1), scopes() {
+  /* Create the top-level scope */
+  push_scope();
+
+  /* Populate the top-level scope with all the primitive declarations */
+  const Symbol s_int = Symbol("int");
+  const Symbol s_string = Symbol("string");
+  enter_primitive("print_err", boost::none, {s_string});
+  enter_primitive("print", boost::none, {s_string});
+  enter_primitive("print_int", boost::none, {s_int});
+  enter_primitive("flush", boost::none, {});
+  enter_primitive("getchar", s_string, {});
+  enter_primitive("read_line", s_string, {});
+  enter_primitive("read_all", s_string, {});
+  enter_primitive("clock_ns", s_int, {});
+  enter_primitive("cycles", s_int, {});
+  enter_primitive("ord", s_int, {s_string});
+  enter_primitive("char_at", s_int, {s_string, s_int});
+  enter_primitive("chr", s_string, {s_int});
+  enter_primitive("int_to_string", s_string, {s_int});
+  enter_primitive("string_to_int", s_int, {s_string});
+  enter_primitive("size", s_int, {s_string});
+  enter_primitive("substring", s_string, {s_string, s_int, s_int});
+  enter_primitive("concat", s_string, {s_string, s_string});
+  enter_primitive("strcmp", s_int, {s_string, s_string});
+  enter_primitive("streq", s_int, {s_string, s_string});
+  enter_primitive("intern", s_string, {s_string});
+  enter_primitive("not", s_int, {s_int});
+  enter_primitive("exit", boost::none, {s_int});
+}
+
+/* Declares a new primitive into the current scope */
+void Binder::enter_primitive(const std::string &name,
+                             const boost::optional<Symbol> &type_name,
+                             const std::vector<Symbol> &argument_typenames) {
+  std::vector<VarDecl *> args;
+  int counter = 0;
+  for (const Symbol &tn : argument_typenames) {
+    std::ostringstream argname;
+    argname << "a_" << counter++;
+    args.push_back(new VarDecl(utils::nl, Symbol(argname.str()), nullptr, tn));
+  }
+
+  FunDecl *fd = new FunDecl(utils::nl, Symbol(name), std::move(args), nullptr,
+                            type_name, true);
+  fd->set_external_name(Symbol("__" + name));
+  enter(*fd);
+}
+
+/* Sets the parent of a function declaration and computes and sets
+ * its unique external name */
+void Binder::set_parent_and_external_name(FunDecl &decl) {
+  auto parent = functions.empty() ? nullptr : functions.back();
+  Symbol external_name;
+  if (parent) {
+    decl.set_parent(parent);
+    external_name = parent->get_external_name().get() + '.' + decl.name.get();
+  } else
+    external_name = decl.name;
+  while (external_names.find(external_name) != external_names.end())
+    external_name = Symbol(external_name.get() + '_');
+  external_names.insert(external_name);
+  decl.set_external_name(external_name);
+}
+
+/* Binds a whole program. This method wraps the program inside a top-level main
+ * function.  Then, it visits the programs with the Binder visitor; binding
+ * each identifier to its declaration and computing depths.*/
+FunDecl *Binder::analyze_program(Expr &root) {
+  std::vector<VarDecl *> main_params;
+  Sequence *const main_body = new Sequence(
+      utils::nl,
+      std::vector<Expr *>({&root, new IntegerLiteral(utils::nl, 0)}));
+  FunDecl *const main = new FunDecl(utils::nl, Symbol("main"), main_params,
+                                    main_body, Symbol("int"), true);
+  main->accept(*this);
+  return main;
+}
+
+void Binder::visit(IntegerLiteral &literal) {
+}
+
+void Binder::visit(StringLiteral &literal) {
+}
+
+void Binder::visit(BinaryOperator &op) {
+  op.get_left().accept(*this);
+  op.get_right().accept(*this);
+}
+
+void Binder::visit(Sequence &seq) {
+  for (auto expr : seq.get_exprs())
+    expr->accept(*this);
+}
+
+/* Visit a let node. Consecutive function declarations are entered in the
+ * scope before their bodies are analyzed, so that they may be mutually
+ * recursive. A null loop is pushed while analyzing the declarations, so
+ * that they cannot break out of an enclosing loop. */
+void Binder::visit(Let &let) {
+  push_scope();
+  loops.push_back(nullptr);
+
+  auto &decls = let.get_decls();
+  for (auto decl = decls.begin(); decl != decls.end();) {
+    if (!dynamic_cast<FunDecl *>(*decl)) {
+      (*decl)->accept(*this);
+      decl++;
+      continue;
+    }
+    auto group_end = decl;
+    for (; group_end != decls.end() && dynamic_cast<FunDecl *>(*group_end);
+         group_end++) {
+      (*group_end)->set_depth(depth);
+      enter(**group_end);
+    }
+    for (; decl != group_end; decl++)
+      (*decl)->accept(*this);
+  }
+
+  loops.pop_back();
+  let.get_sequence().accept(*this);
+  pop_scope();
+}
+
+void Binder::visit(Identifier &id) { resolve(id); }
+
+void Binder::visit(IfThenElse &ite) {
+  ite.get_condition().accept(*this);
+  ite.get_then_part().accept(*this);
+  ite.get_else_part().accept(*this);
+}
+
+/* The initial value is analyzed before the variable enters the scope */
+void Binder::visit(VarDecl &decl) {
+  if (auto expr = decl.get_expr())
+    expr->accept(*this);
+  enter_variable(decl);
+}
+
+/* Analyzes the parameters and the body of a function in a new scope, one
+ * level deeper than its declaration */
+void Binder::visit(FunDecl &decl) {
+  set_parent_and_external_name(decl);
+  functions.push_back(&decl);
+  depth++;
+
+  push_scope();
+  for (auto param : decl.get_params())
+    param->accept(*this);
+  if (auto expr = decl.get_expr())
+    expr->accept(*this);
+  pop_scope();
+
+  depth--;
+  functions.pop_back();
+}
+
+void Binder::visit(FunCall &call) {
+  FunDecl *decl = dynamic_cast<FunDecl *>(&find(call.loc, call.func_name));
+  if (!decl)
+    error(call.loc, call.func_name.get() +
+                        " does not denote a function name in this context");
+  call.set_decl(decl);
+  call.set_depth(depth);
+  for (auto arg : call.get_args())
+    arg->accept(*this);
+}
+
+/* The condition is analyzed outside of the loop, so that it cannot break */
+void Binder::visit(WhileLoop &loop) {
+  loop.get_condition().accept(*this);
+  loops.push_back(&loop);
+  loop.get_body().accept(*this);
+  loops.pop_back();
+}
+
+/* The bounds are analyzed outside of the loop and before the index
+ * enters its scope */
+void Binder::visit(ForLoop &loop) {
+  loop.get_high().accept(*this);
+  push_scope();
+  loop.get_variable().accept(*this);
+  loops.push_back(&loop);
+  loop.get_body().accept(*this);
+  loops.pop_back();
+  pop_scope();
+}
+
+void Binder::visit(Break &b) {
+  if (loops.empty() || !loops.back())
+    error(b.loc, "break cannot occur outside a loop or inside a declaration");
+  b.set_loop(loops.back());
+}
+
+void Binder::visit(Assign &assign) {
+  assign.get_lhs().accept(*this);
+  VarDecl &decl = assign.get_lhs().get_decl().get();
+  if (decl.read_only)
+    error(assign.loc,
+          "unable to assign value to read-only variable " + decl.name.get());
+  assign.get_rhs().accept(*this);
+}
+
+} // namespace binder
+} // namespace ast
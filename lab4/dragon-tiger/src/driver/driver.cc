@@ -18,6 +18,9 @@ int main(int argc, char **argv) {
   ("help,h", "describe arguments")
   ("dump-ast", "dump the parsed AST")
   ("dump-ir", "dump the generated IR")
+  ("emit-bc", "write the generated module as LLVM bitcode")
+  ("output,o", po::value(&output_file)->default_value("-"),
+   "output file for the IR or bitcode (- for stdout)")
   ("bind,b", "run the binder on the parsed AST")
   ("type,t", "run the type checker on the parsed AST")
   ("irgen,i", "run the LLVM IR code generator")
@@ -69,8 +72,10 @@ int main(int argc, char **argv) {
     irgen::IRGenerator ir_generator;
     ir_generator.generate_program(main);
 
-    if (vm.count("dump-ir")) {
-      ir_generator.print_ir(&std::cout);
+    if (vm.count("emit-bc")) {
+      ir_generator.write_bitcode(output_file);
+    } else if (vm.count("dump-ir")) {
+      ir_generator.print_ir(output_file);
     }
   }
 
@@ -0,0 +1,152 @@
+#include "irgen/folder.hh"
+
+namespace irgen {
+
+namespace {
+
+optional<Constant> integer(int32_t i) {
+  return Constant{t_int, i, std::string()};
+}
+
+optional<Constant> string(const std::string &s) {
+  return Constant{t_string, 0, s};
+}
+
+// Same as __strcmp: compare bytes as unsigned chars, then lengths.
+int32_t compare(const std::string &a, const std::string &b) {
+  int cmp = a.compare(b);
+  return (cmp > 0) - (cmp < 0);
+}
+
+} // namespace
+
+optional<Constant> Folder::fold(const Expr &expr) {
+  auto it = folded.find(&expr);
+  if (it != folded.end())
+    return it->second;
+  optional<Constant> value = evaluate(expr);
+  folded[&expr] = value;
+  return value;
+}
+
+optional<Constant> Folder::evaluate(const Expr &expr) {
+  if (auto literal = dynamic_cast<const IntegerLiteral *>(&expr))
+    return integer(literal->value);
+
+  if (auto literal = dynamic_cast<const StringLiteral *>(&expr))
+    return string(literal->value.get());
+
+  // Only a sequence of one expression has no other effect.
+  if (auto seq = dynamic_cast<const Sequence *>(&expr)) {
+    if (seq->get_exprs().size() != 1)
+      return boost::none;
+    return fold(*seq->get_exprs()[0]);
+  }
+
+  if (auto call = dynamic_cast<const FunCall *>(&expr))
+    return evaluate_call(*call);
+
+  auto op = dynamic_cast<const BinaryOperator *>(&expr);
+  if (!op)
+    return boost::none;
+  optional<Constant> l = fold(op->get_left());
+  optional<Constant> r = fold(op->get_right());
+  if (!l || !r)
+    return boost::none;
+
+  // Strings are compared as with __strcmp, integers as signed values.
+  int32_t cmp = l->type == t_string
+                    ? compare(l->string, r->string)
+                    : (l->integer > r->integer) - (l->integer < r->integer);
+  // Arithmetic wraps around as in the generated code.
+  uint32_t a = l->integer, b = r->integer;
+  switch (op->op) {
+  case o_plus: return integer(a + b);
+  case o_minus: return integer(a - b);
+  case o_times: return integer(a * b);
+  case o_divide:
+    if (r->integer == 0 || (l->integer == INT32_MIN && r->integer == -1))
+      return boost::none;
+    return integer(l->integer / r->integer);
+  case o_eq: return integer(cmp == 0);
+  case o_neq: return integer(cmp != 0);
+  case o_lt: return integer(cmp < 0);
+  case o_le: return integer(cmp <= 0);
+  case o_gt: return integer(cmp > 0);
+  case o_ge: return integer(cmp >= 0);
+  default: return boost::none;
+  }
+}
+
+optional<Constant> Folder::evaluate_call(const FunCall &call) {
+  const FunDecl &decl = call.get_decl().get();
+  if (decl.get_expr())
+    return boost::none;
+
+  std::vector<Constant> args;
+  for (auto arg : call.get_args()) {
+    optional<Constant> value = fold(*arg);
+    if (!value)
+      return boost::none;
+    args.push_back(*value);
+  }
+
+  const std::string &name = decl.get_external_name().get();
+  if (name == "__size")
+    return integer(args[0].string.size());
+  if (name == "__ord")
+    return integer(args[0].string.empty()
+                       ? -1
+                       : static_cast<unsigned char>(args[0].string[0]));
+  if (name == "__char_at") {
+    int32_t i = args[1].integer;
+    if (i < 0 || i >= static_cast<int32_t>(args[0].string.size()))
+      return boost::none;
+    return integer(static_cast<unsigned char>(args[0].string[i]));
+  }
+  if (name == "__concat")
+    return string(args[0].string + args[1].string);
+  if (name == "__strcmp")
+    return integer(compare(args[0].string, args[1].string));
+  if (name == "__streq")
+    return integer(args[0].string == args[1].string);
+  if (name == "__not")
+    return integer(args[0].integer == 0);
+  if (name == "__int_to_string")
+    return string(std::to_string(args[0].integer));
+
+  if (name == "__string_to_int") {
+    const std::string &s = args[0].string;
+    bool negative = !s.empty() && s[0] == '-';
+    if (s.size() == size_t(negative))
+      return boost::none;
+    uint64_t value = 0;
+    for (size_t i = negative; i < s.size(); i++) {
+      unsigned digit = static_cast<unsigned char>(s[i]) - '0';
+      value = value * 10 + digit;
+      if (digit > 9 || value > uint64_t(INT32_MAX) + negative)
+        return boost::none;
+    }
+    return integer(negative ? -int64_t(value) : int64_t(value));
+  }
+
+  if (name == "__chr") {
+    int32_t i = args[0].integer;
+    if (i < 0 || i > 255)
+      return boost::none;
+    return string(i == 0 ? std::string() : std::string(1, char(i)));
+  }
+
+  if (name == "__substring") {
+    const std::string &s = args[0].string;
+    int32_t first = args[1].integer, length = args[2].integer;
+    if (first < 0 || length < 0 ||
+        first > static_cast<int32_t>(s.size()) - length)
+      return boost::none;
+    return string(s.substr(first, length));
+  }
+
+  return boost::none;
+}
+
+} // namespace irgen
@@ -1,11 +1,110 @@
 #include <cstdlib>  // For exit
 #include <iostream> // For std::cerr
-#include "irgen.hh"
+#include <set>
+#include "irgen/irgen.hh"
 
 #include "llvm/Support/raw_ostream.h"
 
 namespace {
 
+using namespace ast;
+
+// Primitives which never keep a reference to their string arguments
+// once they return.
+const std::set<std::string> consuming_primitives = {
+    "__char_at", "__print_err", "__print",  "__ord",
+    "__size",    "__strcmp",    "__streq",  "__string_to_int"};
+
+// Primitives which do not store strings anywhere but in their result.
+const std::set<std::string> pure_primitives = {
+    "__char_at",       "__chr",      "__concat",    "__getchar",
+    "__int_to_string", "__not",      "__ord",       "__read_all",
+    "__read_line",     "__size",     "__strcmp",    "__streq",
+    "__string_to_int", "__substring"};
+
+// Primitives counted by the runtime allocation statistics.
+const std::set<std::string> counted_primitives = {
+    "__chr",    "__concat",    "__getchar",   "__int_to_string",
+    "__intern", "__read_all",  "__read_line", "__substring"};
+
+// Pure primitives which build new strings.
+const std::set<std::string> allocating_primitives = {
+    "__concat", "__int_to_string", "__read_all", "__read_line",
+    "__substring"};
+
+const std::string &primitive_name(const FunCall &call) {
+  static const std::string none;
+  const FunDecl &decl = call.get_decl().get();
+  return decl.get_expr() ? none : decl.get_external_name().get();
+}
+
+// Return whether the strings allocated while evaluating an expression
+// can only be reachable from its value, that is whether it only reads
+// variables and calls pure primitives. Set allocates if it calls a
+// primitive which builds new strings.
+bool is_pure(const Expr &expr, bool &allocates) {
+  if (dynamic_cast<const IntegerLiteral *>(&expr) ||
+      dynamic_cast<const StringLiteral *>(&expr) ||
+      dynamic_cast<const Identifier *>(&expr))
+    return true;
+
+  if (auto op = dynamic_cast<const BinaryOperator *>(&expr))
+    return is_pure(op->get_left(), allocates) &&
+           is_pure(op->get_right(), allocates);
+
+  if (auto seq = dynamic_cast<const Sequence *>(&expr)) {
+    for (auto e : seq->get_exprs())
+      if (!is_pure(*e, allocates))
+        return false;
+    return true;
+  }
+
+  auto call = dynamic_cast<const FunCall *>(&expr);
+  if (!call || !pure_primitives.count(primitive_name(*call)))
+    return false;
+  if (allocating_primitives.count(primitive_name(*call)))
+    allocates = true;
+  for (auto arg : call->get_args())
+    if (!is_pure(*arg, allocates))
+      return false;
+  return true;
+}
+
+// Return whether the strings allocated while evaluating some operands
+// are all dead once they have been consumed, and whether there are
+// some to start with.
+bool are_temporaries(const std::vector<const Expr *> &operands) {
+  bool allocates = false;
+  for (auto operand : operands)
+    if (!is_pure(*operand, allocates))
+      return false;
+  return allocates;
+}
+
+// Append the operands of a tree of concat calls to pieces, from left
+// to right, which is also their evaluation order.
+void concat_pieces(const Expr &expr, std::vector<const Expr *> &pieces) {
+  auto call = dynamic_cast<const FunCall *>(&expr);
+  if (call && primitive_name(*call) == "__concat") {
+    for (auto arg : call->get_args())
+      concat_pieces(*arg, pieces);
+  } else
+    pieces.push_back(&expr);
+}
+
+// Return whether an expression always yields a canonical string, which
+// is equal to another canonical one only if they are the same pointer:
+// short strings, interned strings and literals (pooled, and interned
+// at startup in programs using intern).
+bool is_canonical(const Expr &expr) {
+  if (dynamic_cast<const StringLiteral *>(&expr))
+    return true;
+  auto call = dynamic_cast<const FunCall *>(&expr);
+  return call && (primitive_name(*call) == "__intern" ||
+                  primitive_name(*call) == "__chr" ||
+                  primitive_name(*call) == "__getchar");
+}
+
 } // namespace
 
 namespace irgen {
@@ -15,21 +114,41 @@ llvm::Value *IRGenerator::visit(const IntegerLiteral &literal) {
 }
 
 llvm::Value *IRGenerator::visit(const StringLiteral &literal) {
-  return Builder.CreateGlobalStringPtr(literal.value.get());
+  return string_literal(literal.value);
 }
 
 llvm::Value *IRGenerator::visit(const BinaryOperator &op) {
+  if (auto value = folder.fold(op))
+    return constant(*value);
+
+  // Strings built only to be compared are freed right afterwards.
+  llvm::Value *region = nullptr;
+  if (op.get_left().get_type() == t_string &&
+      are_temporaries({&op.get_left(), &op.get_right()}))
+    region = enter_region();
+
   llvm::Value *l = op.get_left().accept(*this);
   llvm::Value *r = op.get_right().accept(*this);
 
-  if (op.get_left().get_type() == t_string) {
+  // Equality only needs __strcmp to tell apart strings which are not
+  // obviously equal or different, and none at all for canonical ones.
+  if (op.get_left().get_type() == t_string &&
+      (op.op == o_eq || op.op == o_neq)) {
+    if (!is_canonical(op.get_left()) || !is_canonical(op.get_right())) {
+      l = generate_string_eq(l, r);
+      r = Builder.getInt32(1);
+    }
+  } else if (op.get_left().get_type() == t_string) {
     auto const strcmp = Mod->getOrInsertFunction(
-        "__strcmp", Builder.getInt32Ty(), Builder.getInt8PtrTy(),
-        Builder.getInt8PtrTy(), nullptr);
+        "__strcmp", Builder.getInt32Ty(), llvm_type(t_string),
+        llvm_type(t_string));
     l = Builder.CreateCall(strcmp, {l, r});
     r = Builder.getInt32(0);
   }
 
+  if (region)
+    exit_region(region);
+
   switch(op.op) {
     case o_plus: return Builder.CreateBinOp(llvm::Instruction::Add, l, r);
     case o_minus: return Builder.CreateBinOp(llvm::Instruction::Sub, l, r);
@@ -40,6 +159,7 @@ llvm::Value *IRGenerator::visit(const BinaryOperator &op) {
 
   // Comparisons return an i1 result which needs to be
   // casted to i32, as Tiger might use that as an integer.
+  // True is 1, as in the folder.
   llvm::Value *cmp;
 
   switch(op.op) {
@@ -52,7 +172,7 @@ llvm::Value *IRGenerator::visit(const BinaryOperator &op) {
     default: assert(false); __builtin_unreachable();
   }
 
-  return Builder.CreateIntCast(cmp, Builder.getInt32Ty(), true);
+  return Builder.CreateZExt(cmp, Builder.getInt32Ty());
 }
 
 llvm::Value *IRGenerator::visit(const Sequence &seq) {
@@ -78,11 +198,11 @@ llvm::Value *IRGenerator::visit(const IfThenElse &ite) {
     pointer = alloca_in_entry(llvm_type(ite.get_type()),"if_result");
   // Creation of the block and the condition
   llvm::BasicBlock *const if_then =
-      llvm::BasicBlock::Create(Context, "if_then", current_function);
+      llvm::BasicBlock::Create(*Context, "if_then", current_function);
   llvm::BasicBlock *const if_else =
-      llvm::BasicBlock::Create(Context, "if_else", current_function);
+      llvm::BasicBlock::Create(*Context, "if_else", current_function);
   llvm::BasicBlock *const if_end =
-      llvm::BasicBlock::Create(Context, "if_end", current_function);
+      llvm::BasicBlock::Create(*Context, "if_end", current_function);
 
   llvm::Value * cond_value = ite.get_condition().accept(*this);
   llvm::Value * cond = Builder.CreateICmpNE(cond_value,Builder.getInt32(0));
@@ -121,7 +241,9 @@ llvm::Value *IRGenerator::visit(const VarDecl &decl) {
 
   if (value != nullptr)
     Builder.CreateStore(value,pointer);
-  return nullptr;
+  // Return the variable address, which is used as the index
+  // of for loops
+  return pointer;
 }
 
 llvm::Value *IRGenerator::visit(const FunDecl &decl) {
@@ -160,6 +282,35 @@ llvm::Value *IRGenerator::visit(const Identifier &id) {
 }
 
 llvm::Value *IRGenerator::visit(const FunCall &call) {
+  // Primitives called on constant arguments are evaluated at compile
+  // time.
+  if (auto value = folder.fold(call))
+    return constant(*value);
+
+  // ord(substring(s, i, 1)) reads the character in place.
+  if (primitive_name(call) == "__ord") {
+    auto sub = dynamic_cast<const FunCall *>(call.get_args()[0]);
+    if (sub && primitive_name(*sub) == "__substring") {
+      auto length = folder.fold(*sub->get_args()[2]);
+      if (length && length->integer == 1)
+        return generate_char_at(*sub->get_args()[0], *sub->get_args()[1]);
+    }
+  }
+
+  // print(concat(...)) writes the pieces of the concatenation one
+  // after the other instead of building it.
+  if (primitive_name(call) == "__print") {
+    std::vector<const Expr *> pieces;
+    concat_pieces(*call.get_args()[0], pieces);
+    if (pieces.size() > 1 && !folder.fold(*call.get_args()[0])) {
+      llvm::Value *region = are_temporaries(pieces) ? enter_region() : nullptr;
+      generate_printv(pieces);
+      if (region)
+        exit_region(region);
+      return nullptr;
+    }
+  }
+
   // Look up the name in the global module table.
   const FunDecl &decl = call.get_decl().get();
   llvm::Function *callee =
@@ -184,28 +335,39 @@ llvm::Value *IRGenerator::visit(const FunCall &call) {
     }
   }    
   
+  // Strings built only to be consumed by a primitive which does not
+  // keep them are freed as soon as it returns.
+  llvm::Value *region = nullptr;
+  if (consuming_primitives.count(primitive_name(call)) &&
+      are_temporaries({call.get_args().begin(), call.get_args().end()}))
+    region = enter_region();
+
   for (auto expr : call.get_args()) {
     args_values.push_back(expr->accept(*this));
   }
 
-  if (decl.get_type() == t_void) {
-    Builder.CreateCall(callee, args_values);
-    return nullptr;
-  }
-  return Builder.CreateCall(callee, args_values, "call");
+  if (alloc_sites && counted_primitives.count(primitive_name(call)))
+    generate_alloc_site(call);
+
+  llvm::Value *result = decl.get_type() == t_void
+                            ? Builder.CreateCall(callee, args_values)
+                            : Builder.CreateCall(callee, args_values, "call");
+  if (region)
+    exit_region(region);
+  return decl.get_type() == t_void ? nullptr : result;
 }
 
 llvm::Value *IRGenerator::visit(const WhileLoop &loop) {
   // Creation the the blocks and of the condition
   llvm::BasicBlock *const test_block =
-      llvm::BasicBlock::Create(Context, "while_test", current_function);
+      llvm::BasicBlock::Create(*Context, "while_test", current_function);
   llvm::BasicBlock *const body_block =
-      llvm::BasicBlock::Create(Context, "while_body", current_function);
+      llvm::BasicBlock::Create(*Context, "while_body", current_function);
   llvm::BasicBlock *const end_block =
-      llvm::BasicBlock::Create(Context, "while_end", current_function);
+      llvm::BasicBlock::Create(*Context, "while_end", current_function);
 
   Builder.CreateBr(test_block);
-  loop_exit_bbs.insert(std::pair<const Loop *, llvm::BasicBlock *>(&loop,end_block));
+  loop_exit_bbs[&loop] = end_block;
 
   // We test the condition in each iteration via this block.
   Builder.SetInsertPoint(test_block);
@@ -224,16 +386,16 @@ llvm::Value *IRGenerator::visit(const WhileLoop &loop) {
 
 llvm::Value *IRGenerator::visit(const ForLoop &loop) {
   llvm::BasicBlock *const test_block =
-          llvm::BasicBlock::Create(Context, "loop_test", current_function);
+          llvm::BasicBlock::Create(*Context, "loop_test", current_function);
   llvm::BasicBlock *const body_block =
-          llvm::BasicBlock::Create(Context, "loop_body", current_function);
+          llvm::BasicBlock::Create(*Context, "loop_body", current_function);
   llvm::BasicBlock *const end_block =
-          llvm::BasicBlock::Create(Context, "loop_end", current_function);
+          llvm::BasicBlock::Create(*Context, "loop_end", current_function);
 
   llvm::Value *const index = loop.get_variable().accept(*this);
   llvm::Value *const high = loop.get_high().accept(*this);
   Builder.CreateBr(test_block);
-  loop_exit_bbs.insert(std::pair<const Loop *, llvm::BasicBlock *>(&loop,end_block));
+  loop_exit_bbs[&loop] = end_block;
 
   Builder.SetInsertPoint(test_block);
   Builder.CreateCondBr(Builder.CreateICmpSLE(Builder.CreateLoad(index), high),
@@ -253,6 +415,10 @@ llvm::Value *IRGenerator::visit(const ForLoop &loop) {
 llvm::Value *IRGenerator::visit(const Break &b) {
   llvm::BasicBlock * exit_block = loop_exit_bbs[b.get_loop().get_ptr()];
   Builder.CreateBr(exit_block);
+  // The code following the break is unreachable, but must still
+  // go in a block of its own after the terminator.
+  Builder.SetInsertPoint(
+      llvm::BasicBlock::Create(*Context, "after_break", current_function));
   return nullptr;
 }
 
@@ -1,15 +1,35 @@
-#include "irgen.hh"
-#include "../utils/errors.hh"
+#include <algorithm>
 
+// lab6 compiles this code generator too, so its headers are included
+// from src/ and each lab gets its own AST and irgen declarations.
+#include "irgen/irgen.hh"
+#include "utils/errors.hh"
+
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 
 using utils::error;
 
 namespace irgen {
 
-IRGenerator::IRGenerator() : Builder(Context) {
-  Mod = llvm::make_unique<llvm::Module>("tiger", Context);
+IRGenerator::IRGenerator(bool alloc_sites)
+    : Context(llvm::make_unique<llvm::LLVMContext>()), Builder(*Context),
+      alloc_sites(alloc_sites) {
+  Mod = llvm::make_unique<llvm::Module>("tiger", *Context);
+  StringTy = llvm::StructType::create(
+      *Context,
+      {Builder.getInt32Ty(), llvm::ArrayType::get(Builder.getInt8Ty(), 0)},
+      "string");
+}
+
+std::unique_ptr<llvm::Module> IRGenerator::take_module() {
+  return std::move(Mod);
+}
+
+std::unique_ptr<llvm::LLVMContext> IRGenerator::take_context() {
+  return std::move(Context);
 }
 
 llvm::Type *IRGenerator::llvm_type(const ast::Type ast_type) {
@@ -17,7 +37,7 @@ llvm::Type *IRGenerator::llvm_type(const ast::Type ast_type) {
   case t_int:
     return Builder.getInt32Ty();
   case t_string:
-    return Builder.getInt8PtrTy();
+    return StringTy->getPointerTo();
   case t_void:
     return Builder.getVoidTy();
   default:
@@ -34,14 +54,169 @@ llvm::Value *IRGenerator::alloca_in_entry(llvm::Type *Ty,
   return value;
 }
 
-void IRGenerator::print_ir(std::ostream *ostream) {
-  // FIXME: This is inefficient. Should probably take a filename
-  // and use directly LLVM raw stream interface
-  std::string buffer;
-  llvm::raw_string_ostream OS(buffer);
-  OS << *Mod;
-  OS.flush();
-  *ostream << buffer;
+/* Generate a folded constant */
+llvm::Constant *IRGenerator::constant(const Constant &value) {
+  if (value.type == t_int)
+    return Builder.getInt32(value.integer);
+  return string_literal(Symbol(value.string));
+}
+
+/* Start a region of temporary strings in the runtime, and return the
+enclosing one */
+llvm::Value *IRGenerator::enter_region() {
+  auto const enter = Mod->getOrInsertFunction("__region_enter",
+                                              Builder.getInt8PtrTy());
+  return Builder.CreateCall(enter, {}, "region");
+}
+
+/* Free the strings allocated since the matching enter_region */
+void IRGenerator::exit_region(llvm::Value *outer) {
+  auto const exit = Mod->getOrInsertFunction(
+      "__region_exit", Builder.getVoidTy(), Builder.getInt8PtrTy());
+  Builder.CreateCall(exit, {outer});
+}
+
+/* Generate a call to __char_at, which reads a character of a string
+without building a substring */
+llvm::Value *IRGenerator::generate_char_at(const Expr &s, const Expr &i) {
+  llvm::Value *const string = s.accept(*this);
+  llvm::Value *const index = i.accept(*this);
+  auto const char_at = Mod->getOrInsertFunction(
+      "__char_at", Builder.getInt32Ty(), llvm_type(t_string),
+      Builder.getInt32Ty());
+  return Builder.CreateCall(char_at, {string, index}, "call");
+}
+
+/* Compare two strings for equality, returning 1 or 0. The common cases
+are decided inline: the same pointer, or two flat strings whose lengths
+or first characters differ. Short strings and ropes are left to
+__streq, as are flat strings which may still be equal */
+llvm::Value *IRGenerator::generate_string_eq(llvm::Value *l, llvm::Value *r) {
+  llvm::BasicBlock *const entry = Builder.GetInsertBlock();
+  llvm::BasicBlock *const tags =
+      llvm::BasicBlock::Create(*Context, "streq_tags", current_function);
+  llvm::BasicBlock *const flat =
+      llvm::BasicBlock::Create(*Context, "streq_flat", current_function);
+  llvm::BasicBlock *const slow =
+      llvm::BasicBlock::Create(*Context, "streq_slow", current_function);
+  llvm::BasicBlock *const end =
+      llvm::BasicBlock::Create(*Context, "streq_end", current_function);
+
+  Builder.CreateCondBr(Builder.CreateICmpEQ(l, r), end, tags);
+
+  // Flat strings have both tag bits clear.
+  Builder.SetInsertPoint(tags);
+  llvm::Value *const bits = Builder.CreateOr(
+      Builder.CreatePtrToInt(l, Builder.getInt64Ty()),
+      Builder.CreatePtrToInt(r, Builder.getInt64Ty()));
+  Builder.CreateCondBr(
+      Builder.CreateICmpEQ(Builder.CreateAnd(bits, 3), Builder.getInt64(0)),
+      flat, slow);
+
+  // Flat strings are longer than short ones, so they have a first
+  // character.
+  Builder.SetInsertPoint(flat);
+  llvm::Value *const l_length =
+      Builder.CreateLoad(Builder.CreateStructGEP(StringTy, l, 0));
+  llvm::Value *const r_length =
+      Builder.CreateLoad(Builder.CreateStructGEP(StringTy, r, 0));
+  llvm::Value *const l_first =
+      Builder.CreateLoad(Builder.CreateConstGEP2_32(
+          StringTy->getElementType(1), Builder.CreateStructGEP(StringTy, l, 1),
+          0, 0));
+  llvm::Value *const r_first =
+      Builder.CreateLoad(Builder.CreateConstGEP2_32(
+          StringTy->getElementType(1), Builder.CreateStructGEP(StringTy, r, 1),
+          0, 0));
+  Builder.CreateCondBr(
+      Builder.CreateAnd(Builder.CreateICmpEQ(l_length, r_length),
+                        Builder.CreateICmpEQ(l_first, r_first)),
+      slow, end);
+
+  Builder.SetInsertPoint(slow);
+  auto const streq = Mod->getOrInsertFunction(
+      "__streq", Builder.getInt32Ty(), llvm_type(t_string),
+      llvm_type(t_string));
+  llvm::Value *const result = Builder.CreateCall(streq, {l, r}, "call");
+  Builder.CreateBr(end);
+
+  Builder.SetInsertPoint(end);
+  llvm::PHINode *const phi = Builder.CreatePHI(Builder.getInt32Ty(), 3);
+  phi->addIncoming(Builder.getInt32(1), entry);
+  phi->addIncoming(Builder.getInt32(0), flat);
+  phi->addIncoming(result, slow);
+  return phi;
+}
+
+/* Print strings one after the other with a single runtime call, which
+gets them through an array in the frame */
+void IRGenerator::generate_printv(const std::vector<const Expr *> &pieces) {
+  llvm::Type *const type = llvm_type(t_string);
+  llvm::ArrayType *const array_type =
+      llvm::ArrayType::get(type, pieces.size());
+  llvm::Value *const array = alloca_in_entry(array_type, "pieces");
+  for (size_t i = 0; i < pieces.size(); i++)
+    Builder.CreateStore(pieces[i]->accept(*this),
+                        Builder.CreateConstGEP2_32(array_type, array, 0, i));
+
+  auto const printv = Mod->getOrInsertFunction(
+      "__printv", Builder.getVoidTy(), type->getPointerTo(),
+      Builder.getInt32Ty());
+  Builder.CreateCall(printv,
+                     {Builder.CreateConstGEP2_32(array_type, array, 0, 0),
+                      Builder.getInt32(pieces.size())});
+}
+
+/* Emit a string literal, with its length, as a private unnamed_addr
+constant the first time it is seen, and reuse it afterwards. Short
+literals are encoded as tagged immediates: bit 0 set, the length in
+bits 1-7 and the characters in the following bytes */
+llvm::Constant *IRGenerator::string_literal(const Symbol &value) {
+  llvm::Constant *&pointer = string_literals[value];
+  const std::string &text = value.get();
+  if (!pointer && text.size() <= 7) {
+    uint64_t immediate = (text.size() << 1) | 1;
+    for (size_t i = 0; i < text.size(); i++)
+      immediate |= uint64_t(static_cast<unsigned char>(text[i]))
+                   << (8 * (i + 1));
+    pointer = llvm::ConstantExpr::getIntToPtr(Builder.getInt64(immediate),
+                                              StringTy->getPointerTo());
+  }
+  if (!pointer) {
+    llvm::Constant *bytes =
+        llvm::ConstantDataArray::getString(*Context, text);
+    llvm::Constant *init = llvm::ConstantStruct::getAnon(
+        {Builder.getInt32(text.size()), bytes});
+    auto var = new llvm::GlobalVariable(*Mod, init->getType(), true,
+                                        llvm::GlobalValue::PrivateLinkage,
+                                        init, ".str");
+    var->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    var->setAlignment(4);
+    pointer = llvm::ConstantExpr::getBitCast(var, StringTy->getPointerTo());
+  }
+  return pointer;
+}
+
+/* Open the output file, "-" meaning the standard output. The module is
+streamed directly into it, without building an intermediate copy. */
+std::unique_ptr<llvm::raw_fd_ostream>
+IRGenerator::open_output(const std::string &filename, bool binary) {
+  std::error_code EC;
+  auto OS = llvm::make_unique<llvm::raw_fd_ostream>(
+      filename, EC, binary ? llvm::sys::fs::F_None : llvm::sys::fs::F_Text);
+  if (EC)
+    error("cannot open " + filename + ": " + EC.message());
+  return OS;
+}
+
+void IRGenerator::print_ir(const std::string &filename) {
+  auto OS = open_output(filename, false);
+  *OS << *Mod;
+}
+
+void IRGenerator::write_bitcode(const std::string &filename) {
+  auto OS = open_output(filename, true);
+  llvm::WriteBitcodeToFile(*Mod, *OS);
 }
 
 llvm::Value *IRGenerator::address_of(const Identifier &id) {
@@ -55,7 +230,7 @@ llvm::Value *IRGenerator::address_of(const Identifier &id) {
     return allocations[&decl];
   else{
     std::pair<llvm::StructType *, llvm::Value *> pair = frame_up(depth_diff);
-    int position = frame_position[&id.get_decl().get()];
+    int position = frame_position[&decl];
 
     return Builder.CreateStructGEP(pair.first,pair.second, position,id.name.get());
   }
@@ -68,13 +243,87 @@ void IRGenerator::generate_program(FunDecl *main) {
     generate_function(*pending_func_bodies.back());
     pending_func_bodies.pop_back();
   }
+
+  // Programs using intern need their literals to be canonical as well.
+  if (Mod->getFunction("__intern"))
+    generate_interned_literals(
+        *Mod->getFunction(main->get_external_name().get()));
+
+  if (!alloc_site_names.empty())
+    generate_alloc_site_names(
+        *Mod->getFunction(main->get_external_name().get()));
 }
 
-void IRGenerator::generate_function(const FunDecl &decl) {
-  // Reinitialize common structures.
-  allocations.clear();
-  loop_exit_bbs.clear();
+/* Give the next call site number to a call, and store it into the
+runtime __alloc_site variable right before the call */
+void IRGenerator::generate_alloc_site(const FunCall &call) {
+  const yy::position &begin = call.loc.begin;
+  alloc_site_names.push_back((begin.filename ? *begin.filename : "") + ":" +
+                             std::to_string(begin.line) + ":" +
+                             std::to_string(begin.column));
+  Builder.CreateStore(Builder.getInt32(alloc_site_names.size()),
+                      Mod->getOrInsertGlobal("__alloc_site",
+                                             Builder.getInt32Ty()));
+}
+
+/* Pass the locations of the call sites to the runtime at the start of
+main, as an array of C strings */
+void IRGenerator::generate_alloc_site_names(llvm::Function &main) {
+  std::vector<llvm::Constant *> names;
+  for (auto &name : alloc_site_names) {
+    llvm::Constant *text = llvm::ConstantDataArray::getString(*Context, name);
+    auto var = new llvm::GlobalVariable(*Mod, text->getType(), true,
+                                        llvm::GlobalValue::PrivateLinkage,
+                                        text, ".site");
+    var->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    names.push_back(
+        llvm::ConstantExpr::getBitCast(var, Builder.getInt8PtrTy()));
+  }
+  llvm::ArrayType *const array_type =
+      llvm::ArrayType::get(Builder.getInt8PtrTy(), names.size());
+  auto const array = new llvm::GlobalVariable(
+      *Mod, array_type, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(array_type, names), "sites");
+
+  auto const register_sites = Mod->getOrInsertFunction(
+      "__alloc_sites", Builder.getVoidTy(),
+      Builder.getInt8PtrTy()->getPointerTo(), Builder.getInt32Ty());
+  Builder.SetInsertPoint(main.getEntryBlock().getTerminator());
+  Builder.CreateCall(register_sites,
+                     {Builder.CreateConstGEP2_32(array_type, array, 0, 0),
+                      Builder.getInt32(names.size())});
+}
+
+/* Enter the string literals longer than 7 bytes in the runtime intern
+table at the start of main. They are sorted so that the generated code
+does not depend on the hash table order */
+void IRGenerator::generate_interned_literals(llvm::Function &main) {
+  std::vector<std::pair<std::string, llvm::Constant *>> sorted;
+  for (auto &literal : string_literals)
+    if (literal.first.get().size() > 7)
+      sorted.emplace_back(literal.first.get(), literal.second);
+  std::sort(sorted.begin(), sorted.end());
 
+  std::vector<llvm::Constant *> literals;
+  for (auto &literal : sorted)
+    literals.push_back(literal.second);
+  llvm::Type *const type = llvm_type(t_string);
+  llvm::ArrayType *const array_type =
+      llvm::ArrayType::get(type, literals.size());
+  auto const array = new llvm::GlobalVariable(
+      *Mod, array_type, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(array_type, literals), "literals");
+
+  auto const intern_literals = Mod->getOrInsertFunction(
+      "__intern_literals", Builder.getVoidTy(), type->getPointerTo(),
+      Builder.getInt32Ty());
+  Builder.SetInsertPoint(main.getEntryBlock().getTerminator());
+  Builder.CreateCall(intern_literals,
+                     {Builder.CreateConstGEP2_32(array_type, array, 0, 0),
+                      Builder.getInt32(literals.size())});
+}
+
+void IRGenerator::generate_function(const FunDecl &decl) {
   // Set current function
   current_function = Mod->getFunction(decl.get_external_name().get());
   current_function_decl = &decl;
@@ -82,11 +331,11 @@ void IRGenerator::generate_function(const FunDecl &decl) {
 
   // Create a new basic block to insert allocation insertion
   llvm::BasicBlock *bb1 =
-      llvm::BasicBlock::Create(Context, "entry", current_function);
+      llvm::BasicBlock::Create(*Context, "entry", current_function);
   
   // Create a second basic block for body insertion
   llvm::BasicBlock *bb2 =
-      llvm::BasicBlock::Create(Context, "body", current_function);
+      llvm::BasicBlock::Create(*Context, "body", current_function);
   
   Builder.SetInsertPoint(bb2);
   generate_frame();
@@ -137,14 +386,16 @@ void IRGenerator::generate_frame(){
                         frame_type[&current_function_decl->get_parent().get()];
     types.push_back(parent_struc->getPointerTo());
   }
-  // We store all the escaping declartion in the frame type
+  // We store all the escaping declartion in the frame type, and
+  // remember their position in it
   for (const VarDecl * var : current_function_decl->get_escaping_decls()){
+    frame_position[var] = types.size();
     types.push_back(llvm_type(var->get_type()));
   }
   // We create the structure, store it and create a frame with this type.
   std::string name = "ft_"+current_function_decl->get_external_name().get();
-  llvm::StructType * struct_type = llvm::StructType::create(Context,types,name);
-  frame_type.insert(std::pair<const FunDecl *, llvm::StructType *>(current_function_decl,struct_type));
+  llvm::StructType * struct_type = llvm::StructType::create(*Context,types,name);
+  frame_type[current_function_decl] = struct_type;
   frame = Builder.CreateAlloca(struct_type,nullptr,name);
   
 }
@@ -170,27 +421,17 @@ std::pair<llvm::StructType *, llvm::Value *> IRGenerator::frame_up(int levels){
 Otherwise it is allocated.  */
 llvm::Value * IRGenerator::generate_vardecl(const VarDecl &decl){
   llvm::Value * pointer;
-  // If the function escapes, we store it in the frame after computing
-  // its position with respect to other escaping variables
+  // If the variable escapes, we store it in the frame at the position
+  // computed by generate_frame
   if (decl.get_escapes()){
-    unsigned int position = 0;
-    for (const VarDecl * v : current_function_decl->get_escaping_decls()){
-      if (v->name.get() == decl.name.get())
-        break;
-      position++;
-    }
-    if (current_function_decl->get_parent())
-      position++;
-    frame_position.insert(std::pair<const VarDecl *, int>(&decl,position));
-    
     pointer = Builder.CreateStructGEP(
               frame_type[current_function_decl],
-              frame, position);
+              frame, frame_position[&decl]);
   }
   else
     pointer = alloca_in_entry(llvm_type(decl.get_type()),decl.name.get());
 
-  allocations.insert(std::pair<const VarDecl *, llvm::Value *>(&decl,pointer));
+  allocations[&decl] = pointer;
   
   return pointer;
 }
@@ -0,0 +1,43 @@
+# Helpers shared by the benchmark scripts, which source this file.
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+DTIGER=${DTIGER:-$top/src/driver/dtiger}
+LIBRUNTIME=${LIBRUNTIME:-$top/src/runtime/posix/libruntime.a}
+CC=${CC:-cc}
+RUNS=${RUNS:-3}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' 0 1 2 3 15
+
+# Print the best wall-clock time of $RUNS runs of a command, in seconds.
+# Its output is discarded and its input is empty.
+best() {
+  best_ns=
+  run=0
+  while [ $run -lt "$RUNS" ]; do
+    start=$(date +%s%N)
+    "$@" > /dev/null < /dev/null
+    ns=$(($(date +%s%N) - start))
+    if [ -z "$best_ns" ] || [ $ns -lt "$best_ns" ]; then
+      best_ns=$ns
+    fi
+    run=$((run + 1))
+  done
+  awk -v ns="$best_ns" 'BEGIN { printf "%.3f s", ns / 1e9 }'
+}
+
+# Write a program of $1 functions, each with a small loop, whose main
+# calls one function in $2 and prints the sum of the results.
+functions_program() {
+  awk -v n="$1" -v stride="$2" 'BEGIN {
+    print "let"
+    for (i = 0; i < n; i++)
+      printf "  function f%d(x: int): int = let var s := 0 in for k := 0 to x do (s := s + k * %d; if s > 100000 then s := s - 99991); s end\n", i, i + 1
+    print "  var sum := 0"
+    print "in"
+    for (i = 0; i < n; i += stride)
+      printf "  sum := sum + f%d(3);\n", i
+    print "  print_int(sum); print(\"\\n\")"
+    print "end"
+  }'
+}
@@ -0,0 +1,38 @@
+#! /bin/sh
+#
+# Time spent in the IR generator on a program of VARIABLES variables
+# (100000 by default), all declared in one let and then summed, which
+# stresses the side tables of the variables. The time of the front end
+# alone (-t) is subtracted from that of -i. Other dtiger binaries, such
+# as one built before a change, can be given to compare them.
+#
+# Usage: bench/irgen-vars.sh [VARIABLES [DTIGER...]]
+
+. "$(dirname "$0")/common.sh"
+
+variables=${1:-100000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- "$DTIGER"
+
+awk -v n="$variables" 'BEGIN {
+  print "let"
+  for (i = 0; i < n; i++)
+    printf "  var v%d := %d\n", i, i
+  print "  var s := 0"
+  print "in"
+  for (i = 0; i < n; i++)
+    printf "  s := s + v%d;\n", i
+  print "  print_int(s); print(\"\\n\")"
+  print "end"
+}' > "$tmp/vars.tig"
+
+echo "$variables variables"
+for dtiger in "$@"; do
+  front=$(best "$dtiger" -t "$tmp/vars.tig")
+  irgen=$(best "$dtiger" -i "$tmp/vars.tig")
+  echo "$dtiger"
+  echo "  front end (-t)    $front"
+  echo "  with irgen (-i)   $irgen"
+  echo "  irgen             $(echo "$irgen $front" |
+                              awk '{ printf "%.3f s", $1 - $3 }')"
+done
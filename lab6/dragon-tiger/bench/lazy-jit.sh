@@ -0,0 +1,28 @@
+#! /bin/sh
+#
+# Start-up time of the JIT on a program of FUNCTIONS functions (10000 by
+# default) whose main calls one in STRIDE (100, that is 1%). --run
+# compiles every function before main starts, --run --lazy only those
+# which are called, so its time should follow the called functions and
+# not the program size. The time to generate the IR of the whole
+# program, which both need, is shown for reference.
+#
+# Usage: bench/lazy-jit.sh [FUNCTIONS [STRIDE]]
+
+. "$(dirname "$0")/common.sh"
+
+functions=${1:-10000}
+stride=${2:-100}
+functions_program "$functions" "$stride" > "$tmp/lazy.tig"
+
+eager=$("$DTIGER" --run "$tmp/lazy.tig")
+lazy=$("$DTIGER" --run --lazy "$tmp/lazy.tig")
+if [ "$eager" != "$lazy" ]; then
+  echo "lazy-jit: --run printed $eager but --run --lazy printed $lazy" >&2
+  exit 1
+fi
+
+echo "$functions functions, $((($functions + $stride - 1) / $stride)) called"
+echo "  IR only (-i)      $(best "$DTIGER" -i "$tmp/lazy.tig")"
+echo "  --run             $(best "$DTIGER" --run "$tmp/lazy.tig")"
+echo "  --run --lazy      $(best "$DTIGER" --run --lazy "$tmp/lazy.tig")"
@@ -0,0 +1,49 @@
+#! /bin/sh
+#
+# Scaling of --emit-obj with the number of code generation threads, on
+# a program of FUNCTIONS functions (2000 by default) split into
+# PARTITIONS objects (16). Each object is optimized and compiled on one
+# of the threads, so the time should drop with -j until the threads
+# outnumber the cores or the partitions. The objects must not depend on
+# -j: they are compared with those of -j 1, then linked and run, and
+# must print the same result.
+#
+# Usage: bench/parallel-codegen.sh [FUNCTIONS [PARTITIONS [MAXJOBS]]]
+# MAXJOBS defaults to the number of processors.
+
+. "$(dirname "$0")/common.sh"
+
+functions=${1:-2000}
+partitions=${2:-16}
+maxjobs=${3:-$(getconf _NPROCESSORS_ONLN)}
+functions_program "$functions" 50 > "$tmp/parallel.tig"
+
+# Generate the objects with the given number of threads into $tmp/j$1,
+# and print the time it took.
+emit() {
+  mkdir -p "$tmp/j$1"
+  best "$DTIGER" -i --emit-obj --partitions "$partitions" -j "$1" \
+       -o "$tmp/j$1/p" "$tmp/parallel.tig"
+}
+
+echo "$functions functions, $partitions partitions"
+mkdir -p "$tmp/single"
+printf '  %-20s %s\n' "1 partition -j 1" "$(best "$DTIGER" -i --emit-obj \
+  --partitions 1 -j 1 -o "$tmp/single/p" "$tmp/parallel.tig")"
+jobs=1
+while [ $jobs -le "$maxjobs" ]; do
+  printf '  %-20s %s\n' "$partitions partitions -j $jobs" "$(emit $jobs)"
+  $CC -o "$tmp/j$jobs/a.out" "$tmp/j$jobs"/p.*.o "$LIBRUNTIME"
+  "$tmp/j$jobs/a.out" > "$tmp/j$jobs/out"
+  for object in "$tmp/j1"/p.*.o; do
+    if ! cmp -s "$object" "$tmp/j$jobs/${object##*/}"; then
+      echo "parallel-codegen: ${object##*/} differs with -j $jobs" >&2
+      exit 1
+    fi
+  done
+  if ! cmp -s "$tmp/j1/out" "$tmp/j$jobs/out"; then
+    echo "parallel-codegen: the program prints something else with -j $jobs" >&2
+    exit 1
+  fi
+  jobs=$((jobs * 2))
+done
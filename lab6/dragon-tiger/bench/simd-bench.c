@@ -0,0 +1,63 @@
+// Throughput of each simd_mismatch implementation usable on this
+// processor, and of memcmp for reference, on equal operands of 1 byte
+// to 1 MB, which is the worst case of a string comparison.
+//
+// Build with "make -C bench simd-bench".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simd.h"
+
+#define MAX_LENGTH (1 << 20)
+
+// Bytes compared for each length, so that every measure takes a while.
+#define VOLUME (1 << 28)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t mismatch_memcmp(const char *a, const char *b, size_t n) {
+  return memcmp(a, b, n) ? 0 : n;
+}
+
+// Nanoseconds per call of mismatch on the first n bytes of a and b.
+static double measure(size_t (*mismatch)(const char *, const char *, size_t),
+                      const char *a, const char *b, size_t n) {
+  // The calls go through a volatile pointer so that they are not hoisted.
+  size_t (*volatile call)(const char *, const char *, size_t) = mismatch;
+  size_t calls = VOLUME / n, sum = 0;
+  double start = now();
+  for (size_t i = 0; i < calls; i++)
+    sum += call(a, b, n);
+  double elapsed = now() - start;
+  if (sum != calls * n)
+    abort();
+  return elapsed * 1e9 / calls;
+}
+
+int main(void) {
+  char *a = malloc(MAX_LENGTH), *b = malloc(MAX_LENGTH);
+  if (!a || !b)
+    return 1;
+  for (size_t i = 0; i < MAX_LENGTH; i++)
+    a[i] = b[i] = (char) (i * 31 + 7);
+
+  printf("%10s", "length");
+  for (const struct simd_kernel *k = simd_kernels; k->name; k++)
+    printf(" %12s", k->name);
+  printf(" %12s   (ns per call)\n", "memcmp");
+
+  for (size_t n = 1; n <= MAX_LENGTH; n *= 4) {
+    printf("%10zu", n);
+    for (const struct simd_kernel *k = simd_kernels; k->name; k++)
+      printf(" %12.1f", measure(k->mismatch, a, b, n));
+    printf(" %12.1f\n", measure(mismatch_memcmp, a, b, n));
+  }
+  return 0;
+}
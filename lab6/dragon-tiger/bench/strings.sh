@@ -0,0 +1,64 @@
+#! /bin/sh
+#
+# Cost of the string primitives whose complexity depends on how strings
+# are represented: size of a 4096-byte string, concat of two 64-byte
+# strings, and comparison (= and <) of two equal 4096-byte strings,
+# each done ITERATIONS times (1000000 by default) by a compiled program.
+# Other built trees, such as one from before strings carried their
+# length, can be given to compare them; every tree must print the same.
+#
+# Usage: bench/strings.sh [ITERATIONS [TREE...]]
+# A TREE is a dragon-tiger directory where dtiger and the runtime are
+# built, and defaults to this one.
+
+. "$(dirname "$0")/common.sh"
+set -e
+
+iterations=${1:-1000000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- "$top"
+
+# Write a program which builds a string of 2^$1 bytes as s, runs $2
+# ITERATIONS times and prints n.
+strings_program() {
+  cat <<TIGER
+let
+  function repeat(s: string, doublings: int): string =
+    let var r := s var i := 0
+    in while i < doublings do (r := concat(r, r); i := i + 1); r end
+  var s := repeat("x", $1)
+  var t := repeat("x", $1)
+  var r := ""
+  var n := 0
+  var i := 0
+in
+  while i < $iterations do ($2; i := i + 1);
+  print_int(n + size(r)); print("\n")
+end
+TIGER
+}
+
+strings_program 12 "n := n + size(s)" > "$tmp/size.tig"
+strings_program 6 "r := concat(s, t)" > "$tmp/concat.tig"
+strings_program 12 "if s = t then n := n + 1; if s < t then n := n - 1" \
+  > "$tmp/compare.tig"
+
+echo "$iterations iterations"
+i=0
+for tree in "$@"; do
+  i=$((i + 1))
+  echo "$tree"
+  for bench in size concat compare; do
+    mkdir -p "$tmp/$i"
+    "$tree/src/driver/dtiger" -i --emit-obj -o "$tmp/$i/$bench" \
+      "$tmp/$bench.tig"
+    $CC -O3 -Wl,--gc-sections -o "$tmp/$i/$bench.out" "$tmp/$i/$bench".*.o \
+      "$tree/src/runtime/posix/libruntime.a"
+    "$tmp/$i/$bench.out" > "$tmp/$i/$bench.txt"
+    if ! cmp -s "$tmp/1/$bench.txt" "$tmp/$i/$bench.txt"; then
+      echo "strings: $bench prints something else with $tree" >&2
+      exit 1
+    fi
+    printf '  %-20s %s\n' "$bench" "$(best "$tmp/$i/$bench.out")"
+  done
+done
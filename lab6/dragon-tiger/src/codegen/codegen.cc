@@ -0,0 +1,408 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "codegen.hh"
+#include "../utils/errors.hh"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+using utils::error;
+
+namespace {
+
+// Number of functions above which a new partition is started.
+const unsigned functions_per_partition = 256;
+
+// Upper bound on the number of partitions.
+const unsigned max_partitions = 64;
+
+// Return the target machine of the host, or null with err set.
+std::unique_ptr<llvm::TargetMachine> create_target_machine(std::string &err) {
+  const std::string triple = llvm::sys::getDefaultTargetTriple();
+  const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, err);
+  if (!target)
+    return nullptr;
+  return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      triple, llvm::sys::getHostCPUName(), "", llvm::TargetOptions(),
+      llvm::Reloc::PIC_, llvm::None, llvm::CodeGenOpt::Aggressive));
+}
+
+// Run the same pipeline as "opt -O3" on the module.
+void optimize(llvm::Module &module, llvm::TargetMachine &TM) {
+  llvm::PassManagerBuilder PMB;
+  PMB.OptLevel = 3;
+  PMB.Inliner = llvm::createFunctionInliningPass(3, 0, false);
+  TM.adjustPassManager(PMB);
+
+  llvm::legacy::FunctionPassManager FPM(&module);
+  llvm::legacy::PassManager MPM;
+  PMB.populateFunctionPassManager(FPM);
+  PMB.populateModulePassManager(MPM);
+
+  FPM.doInitialization();
+  for (auto &F : module)
+    FPM.run(F);
+  FPM.doFinalization();
+  MPM.run(module);
+}
+
+// Give a global a link-once definition merged by the linker across the
+// object files which define it, in a COMDAT where the target has them
+// so that the duplicates are dropped as a whole.
+void make_link_once(llvm::GlobalObject &GO) {
+  static const bool comdats =
+      llvm::Triple(llvm::sys::getDefaultTargetTriple()).supportsCOMDAT();
+  GO.setLinkage(llvm::GlobalValue::LinkOnceODRLinkage);
+  GO.setVisibility(llvm::GlobalValue::HiddenVisibility);
+  if (comdats)
+    GO.setComdat(GO.getParent()->getOrInsertComdat(GO.getName()));
+}
+
+// Read the runtime bitcode file, or return null if there is none.
+// Errors are fatal.
+std::unique_ptr<llvm::MemoryBuffer> read_runtime(const std::string &filename) {
+  if (filename.empty())
+    return nullptr;
+  auto buffer = llvm::MemoryBuffer::getFile(filename);
+  if (!buffer)
+    error("cannot read runtime bitcode " + filename + ": " +
+          buffer.getError().message());
+  return std::move(*buffer);
+}
+
+// Link the runtime definitions used by a partition into it, before it
+// is optimized, so that they can be inlined. Every partition gets its
+// own copy, so they are made link-once and the linker keeps one. The
+// runtime's local symbols are renamed and linked the same way, so that
+// its state, such as the intern table, is shared by all the objects.
+// Return an error message, or an empty string on success.
+std::string link_runtime(llvm::Module &module,
+                         const llvm::MemoryBuffer &runtime_bc) {
+  llvm::SMDiagnostic diagnostic;
+  std::unique_ptr<llvm::Module> runtime = llvm::parseIR(
+      runtime_bc.getMemBufferRef(), diagnostic, module.getContext());
+  if (!runtime)
+    return "cannot read runtime bitcode " +
+           runtime_bc.getBufferIdentifier().str() + ": " +
+           diagnostic.getMessage().str();
+  for (auto &GV : runtime->global_values())
+    if (GV.hasLocalLinkage()) {
+      GV.setName("__runtime." + GV.getName());
+      GV.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+
+  // Only the definitions needed by the module are linked.
+  bool failed = llvm::Linker::linkModules(
+      module, std::move(runtime), llvm::Linker::LinkOnlyNeeded,
+      [](llvm::Module &M, const llvm::StringSet<> &linked) {
+        for (auto &GO : M.global_objects())
+          if (!GO.isDeclaration() && linked.count(GO.getName()))
+            make_link_once(GO);
+      });
+  if (failed)
+    return "cannot link runtime bitcode " +
+           runtime_bc.getBufferIdentifier().str();
+  return "";
+}
+
+// Load one partition from its bitcode into a fresh context, link the
+// runtime into it if any, optimize it and write it as an object file.
+// This runs on worker threads, so errors are returned as a message
+// instead of exiting, and the result is empty on success.
+std::string compile_partition(const llvm::SmallString<0> &bitcode,
+                              const llvm::MemoryBuffer *runtime_bc,
+                              const std::string &filename) {
+  llvm::LLVMContext context;
+  auto module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode.str(), filename), context);
+  if (!module)
+    return "codegen: " + llvm::toString(module.takeError());
+  if (runtime_bc) {
+    std::string message = link_runtime(**module, *runtime_bc);
+    if (!message.empty())
+      return message;
+  }
+
+  std::string err;
+  auto TM = create_target_machine(err);
+  if (!TM)
+    return "codegen: " + err;
+  (*module)->setTargetTriple(TM->getTargetTriple().str());
+  (*module)->setDataLayout(TM->createDataLayout());
+  optimize(**module, *TM);
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(filename, EC, llvm::sys::fs::F_None);
+  if (EC)
+    return "cannot open " + filename + ": " + EC.message();
+  llvm::legacy::PassManager CG;
+  if (TM->addPassesToEmitFile(CG, OS, nullptr,
+                              llvm::TargetMachine::CGFT_ObjectFile))
+    return "codegen: the target cannot emit object files";
+  CG.run(**module);
+  return "";
+}
+
+// Run the worker on every index below count, using up to jobs threads.
+// The worker returns an error message, or an empty string on success.
+// Since error() exits, errors are only reported once all the threads
+// are joined, the one with the lowest index first.
+template <typename F> void parallel_for(size_t count, unsigned jobs, F work) {
+  std::vector<std::string> errors(count);
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++)
+      errors[i] = work(i);
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min<size_t>(jobs, count); i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+
+  for (auto &message : errors)
+    if (!message.empty())
+      error(message);
+}
+
+// Give every string literal a name derived from its contents, and make
+// it a hidden linkonce_odr definition. Each function module then holds
+// its own definition of the literals it uses, which does not depend on
+// the other functions, and the linker keeps a single one, so that a
+// literal has the same address everywhere as intern requires.
+void share_string_literals(llvm::Module &module) {
+  for (auto &var : module.globals()) {
+    if (!var.hasPrivateLinkage() || !var.getName().startswith(".str"))
+      continue;
+    auto bytes = llvm::cast<llvm::ConstantDataArray>(
+        var.getInitializer()->getAggregateElement(1u));
+    llvm::SHA1 hasher;
+    hasher.update(bytes->getRawDataValues());
+    var.setName(".str." + llvm::toHex(hasher.final()));
+    var.setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::None);
+    make_link_once(var);
+  }
+}
+
+// Erase the declarations and the discardable definitions which are not
+// used anymore. Erasing a global may leave the ones it used unused, so
+// this is repeated until nothing changes.
+void erase_unused_globals(llvm::Module &module) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto GV = module.global_begin(); GV != module.global_end();) {
+      llvm::GlobalVariable &var = *GV++;
+      var.removeDeadConstantUsers();
+      if (var.use_empty() &&
+          (var.isDeclaration() || var.isDiscardableIfUnused())) {
+        var.eraseFromParent();
+        changed = true;
+      }
+    }
+    for (auto F = module.begin(); F != module.end();) {
+      llvm::Function &function = *F++;
+      function.removeDeadConstantUsers();
+      if (function.use_empty() && function.isDeclaration()) {
+        function.eraseFromParent();
+        changed = true;
+      }
+    }
+  }
+}
+
+// Split the module into one module per function definition. Internal
+// functions are made hidden externals so that they can be called from
+// other objects. Each part only keeps what its function uses, so that
+// its cache key does not change with the rest of the program.
+std::vector<llvm::SmallString<0>>
+split_functions(std::unique_ptr<llvm::Module> module) {
+  for (auto &F : *module)
+    if (F.hasLocalLinkage()) {
+      F.setLinkage(llvm::GlobalValue::ExternalLinkage);
+      F.setVisibility(llvm::GlobalValue::HiddenVisibility);
+    }
+  share_string_literals(*module);
+
+  std::vector<llvm::SmallString<0>> bitcodes;
+  for (auto &F : *module) {
+    if (F.isDeclaration())
+      continue;
+    llvm::ValueToValueMapTy VMap;
+    auto part = llvm::CloneModule(*module, VMap,
+                                  [&](const llvm::GlobalValue *GV) {
+                                    return GV == &F ||
+                                           GV->isDiscardableIfUnused();
+                                  });
+    erase_unused_globals(*part);
+    bitcodes.emplace_back();
+    llvm::raw_svector_ostream OS(bitcodes.back());
+    llvm::WriteBitcodeToFile(*part, OS);
+  }
+  return bitcodes;
+}
+
+// Mark a cache entry as used now. pruneCache evicts the entries used the
+// longest time ago first, and access times are not reliably updated by
+// the file system.
+void touch(const std::string &entry) {
+  int FD;
+  if (llvm::sys::fs::openFileForRead(entry, FD))
+    return;
+  llvm::sys::fs::setLastAccessAndModificationTime(
+      FD, std::chrono::system_clock::now());
+  llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+}
+
+// Return the cache key of a function module: everything that changes
+// the generated object must be part of it, including the runtime linked
+// into it.
+std::string cache_key(const llvm::SmallString<0> &bitcode,
+                      const llvm::MemoryBuffer *runtime_bc) {
+  llvm::SHA1 hasher;
+  hasher.update(bitcode.str());
+  if (runtime_bc)
+    hasher.update(runtime_bc->getBuffer());
+  hasher.update(llvm::sys::getDefaultTargetTriple());
+  hasher.update(llvm::sys::getHostCPUName());
+  hasher.update("O3");
+  return llvm::toHex(hasher.final());
+}
+
+} // namespace
+
+namespace codegen {
+
+unsigned default_partitions(const llvm::Module &module) {
+  unsigned functions = 0;
+  for (auto &F : module)
+    if (!F.isDeclaration())
+      functions++;
+  return std::min(max_partitions,
+                  1 + functions / functions_per_partition);
+}
+
+std::vector<std::string> compile_objects(std::unique_ptr<llvm::Module> module,
+                                         const std::string &prefix,
+                                         const std::string &runtime_bc,
+                                         unsigned partitions, unsigned jobs) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  std::unique_ptr<llvm::MemoryBuffer> runtime = read_runtime(runtime_bc);
+
+  // SplitModule is deterministic for a given number of partitions.
+  // Partitions are serialized so that each worker can rebuild its
+  // own in an independent context.
+  std::vector<llvm::SmallString<0>> bitcodes;
+  llvm::SplitModule(std::move(module), partitions,
+                    [&](std::unique_ptr<llvm::Module> part) {
+                      bitcodes.emplace_back();
+                      llvm::raw_svector_ostream OS(bitcodes.back());
+                      llvm::WriteBitcodeToFile(*part, OS);
+                    });
+
+  std::vector<std::string> filenames;
+  for (unsigned i = 0; i < bitcodes.size(); i++)
+    filenames.push_back(prefix + "." + std::to_string(i) + ".o");
+
+  parallel_for(bitcodes.size(), jobs, [&](size_t i) {
+    return compile_partition(bitcodes[i], runtime.get(), filenames[i]);
+  });
+
+  return filenames;
+}
+
+std::vector<std::string>
+compile_objects_cached(std::unique_ptr<llvm::Module> module,
+                       const std::string &prefix, const std::string &runtime_bc,
+                       const std::string &cache_dir, uint64_t max_bytes,
+                       unsigned jobs, CacheStats &stats) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  std::unique_ptr<llvm::MemoryBuffer> runtime = read_runtime(runtime_bc);
+
+  if (std::error_code EC = llvm::sys::fs::create_directories(cache_dir))
+    error("cannot create " + cache_dir + ": " + EC.message());
+
+  std::vector<llvm::SmallString<0>> bitcodes =
+      split_functions(std::move(module));
+  std::vector<std::string> filenames;
+  for (unsigned i = 0; i < bitcodes.size(); i++)
+    filenames.push_back(prefix + "." + std::to_string(i) + ".o");
+
+  std::atomic<unsigned> hits(0), misses(0);
+  std::atomic<uint64_t> bytes_reused(0), bytes_stored(0);
+  parallel_for(bitcodes.size(), jobs, [&](size_t i) -> std::string {
+    // Entries are named so that llvm::pruneCache manages them.
+    const std::string entry =
+        cache_dir + "/llvmcache-" + cache_key(bitcodes[i], runtime.get());
+    uint64_t size;
+    if (!llvm::sys::fs::file_size(entry, size)) {
+      touch(entry);
+      hits++;
+      bytes_reused += size;
+    } else {
+      // Compile into a temporary file first so that concurrent
+      // compilations never see a partial entry.
+      llvm::SmallString<128> tmp;
+      if (std::error_code EC = llvm::sys::fs::createUniqueFile(
+              cache_dir + "/tmp-%%%%%%%%.o", tmp))
+        return "cannot create a file in " + cache_dir + ": " + EC.message();
+      std::string message =
+          compile_partition(bitcodes[i], runtime.get(), tmp.str());
+      if (message.empty())
+        if (std::error_code EC = llvm::sys::fs::rename(tmp, entry))
+          message = "cannot create " + entry + ": " + EC.message();
+      if (!message.empty()) {
+        llvm::sys::fs::remove(tmp);
+        return message;
+      }
+      llvm::sys::fs::file_size(entry, size);
+      misses++;
+      bytes_stored += size;
+    }
+    if (std::error_code EC = llvm::sys::fs::copy_file(entry, filenames[i]))
+      return "cannot create " + filenames[i] + ": " + EC.message();
+    return "";
+  });
+
+  stats.hits += hits;
+  stats.misses += misses;
+  stats.bytes_reused += bytes_reused;
+  stats.bytes_stored += bytes_stored;
+
+  // Evict the least recently used entries above the size limit.
+  llvm::CachePruningPolicy policy;
+  policy.Interval = std::chrono::seconds(0);
+  policy.MaxSizeBytes = max_bytes;
+  llvm::pruneCache(cache_dir, policy);
+
+  return filenames;
+}
+
+} // namespace codegen
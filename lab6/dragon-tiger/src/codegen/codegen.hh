@@ -0,0 +1,63 @@
+#ifndef CODEGEN_HH
+#define CODEGEN_HH
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+
+namespace codegen {
+
+// Return the number of partitions used for a module. It only depends
+// on the module itself, so that the generated objects are the same
+// whatever the number of worker threads.
+unsigned default_partitions(const llvm::Module &module);
+
+// Split the module into the given number of partitions. The local
+// symbols are externalized as hidden ones and the functions are
+// distributed by a hash of their names; calls between partitions stay
+// direct calls resolved at link time. Keeping local symbols in one
+// partition with their users is not used, as all the Tiger functions
+// are internal and reach each other through main, which would put the
+// whole program in a single partition. If runtime_bc is not empty, the
+// runtime primitives each partition uses are linked into it from this
+// bitcode file, so that they can be inlined and libruntime.a does not
+// have to provide them. Each partition is optimized at -O3 and compiled
+// into an object file named "prefix.N.o" on one of `jobs` worker
+// threads, in its own LLVMContext. Return the names of the object
+// files, which must be linked together to get the whole program.
+std::vector<std::string> compile_objects(std::unique_ptr<llvm::Module> module,
+                                         const std::string &prefix,
+                                         const std::string &runtime_bc,
+                                         unsigned partitions, unsigned jobs);
+
+// Statistics about the object cache use during one compilation.
+struct CacheStats {
+  unsigned hits = 0;
+  unsigned misses = 0;
+  // Size of the objects reused from the cache.
+  uint64_t bytes_reused = 0;
+  // Size of the objects compiled and added to the cache.
+  uint64_t bytes_stored = 0;
+};
+
+// Same as compile_objects, except that every function gets its own
+// object file, cached in cache_dir. The cache key is a hash of the
+// function IR, which covers its bound and typed body, its frame layout
+// and the frame types of its parents, together with the runtime
+// bitcode and the target. The runtime is linked into each function
+// object, so that its primitives are still inlined. Only the functions
+// whose key is missing from the cache are optimized and compiled. Once
+// done, the least recently used entries are evicted so that the cache
+// stays below max_bytes.
+std::vector<std::string>
+compile_objects_cached(std::unique_ptr<llvm::Module> module,
+                       const std::string &prefix, const std::string &runtime_bc,
+                       const std::string &cache_dir, uint64_t max_bytes,
+                       unsigned jobs, CacheStats &stats);
+
+} // namespace codegen
+
+#endif // CODEGEN_HH
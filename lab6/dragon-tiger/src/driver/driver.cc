@@ -1,26 +1,55 @@
+#include <algorithm>
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <thread>
 
 #include "../ast/ast_dumper.hh"
 #include "../ast/binder.hh"
 #include "../ast/escaper.hh"
 #include "../ast/type_checker.hh"
+#include "../codegen/codegen.hh"
 #include "../parser/parser_driver.hh"
 #include "../irgen/irgen.hh"
+#include "../jit/jit.hh"
 #include "../utils/errors.hh"
 
 int main(int argc, char **argv) {
   std::string output_file;
   std::vector<std::string> input_files;
+  int status = 0;
+  unsigned jobs = 0;
+  unsigned partitions = 0;
+  std::string cache_dir;
+  std::string runtime_bc;
+  uint64_t cache_size;
   namespace po = boost::program_options;
   po::options_description options("Options");
   options.add_options()
   ("help,h", "describe arguments")
   ("dump-ast", "dump the parsed AST")
   ("dump-ir", "dump the generated IR")
+  ("emit-bc", "write the generated module as LLVM bitcode")
+  ("alloc-sites",
+   "report string allocations by call site when TIGER_ALLOC_STATS is set")
+  ("emit-obj", "write optimized object files output.N.o, to be linked together")
+  ("output,o", po::value(&output_file)->default_value("-"),
+   "output file for the IR or bitcode (- for stdout), prefix for objects")
+  ("jobs,j", po::value(&jobs), "number of code generation threads")
+  ("partitions", po::value(&partitions),
+   "number of object files generated with --emit-obj")
+  ("cache-dir", po::value(&cache_dir),
+   "with --emit-obj, reuse the objects of unchanged functions from this cache")
+  ("cache-size", po::value(&cache_size)->default_value(512),
+   "maximum size of the object cache in MiB")
+  ("cache-stats", "print object cache statistics")
+  ("runtime-bc", po::value(&runtime_bc),
+   "with --emit-obj, link the runtime bitcode into each object file before "
+   "optimizing it")
   ("bind,b", "run the binder on the parsed AST")
   ("type,t", "run the type checker on the parsed AST")
   ("irgen,i", "run the LLVM IR code generator")
+  ("run,r", "JIT-compile and run the program")
+  ("lazy", "with --run, compile each function on its first call")
   ("trace-parser", "enable parser traces")
   ("trace-lexer", "enable lexer traces")
   ("verbose,v", "be verbose")
@@ -46,6 +75,31 @@ int main(int argc, char **argv) {
     utils::error("usage: dtiger [options] input-file");
   }
 
+  // Both consume the generated module.
+  if (vm.count("emit-obj") && vm.count("run")) {
+    utils::error("--emit-obj and --run cannot be used together");
+  }
+
+  // Options which only refine another one would be silently ignored
+  // without it.
+  if (vm.count("lazy") && !vm.count("run")) {
+    utils::error("--lazy requires --run");
+  }
+  if (vm.count("emit-obj") && !vm.count("irgen")) {
+    utils::error("--emit-obj requires --irgen");
+  }
+  for (const char *option : {"jobs", "partitions", "cache-dir", "runtime-bc"}) {
+    if (vm.count(option) && !vm.count("emit-obj")) {
+      utils::error(std::string("--") + option + " requires --emit-obj");
+    }
+  }
+  if (vm.count("cache-stats") && !vm.count("cache-dir")) {
+    utils::error("--cache-stats requires --cache-dir");
+  }
+  if (vm.count("partitions") && vm.count("cache-dir")) {
+    utils::error("--partitions and --cache-dir cannot be used together");
+  }
+
   ParserDriver parser_driver = ParserDriver(vm.count("trace-lexer"), vm.count("trace-parser"));
 
   if (!parser_driver.parse(input_files[0])) {
@@ -53,24 +107,52 @@ int main(int argc, char **argv) {
   }
 
   FunDecl *main = nullptr;
-  if (vm.count("bind") || vm.count("type") || vm.count("irgen")) {
+  if (vm.count("bind") || vm.count("type") || vm.count("irgen") ||
+      vm.count("run")) {
     ast::binder::Binder binder;
     main = binder.analyze_program(*parser_driver.result_ast);
     ast::escaper::Escaper escaper;
     main->accept(escaper);
   }
 
-  if (vm.count("type") || vm.count("irgen")) {
+  if (vm.count("type") || vm.count("irgen") || vm.count("run")) {
     ast::type_checker::TypeChecker type_checker;
     main->accept(type_checker);
   }
 
-  if (vm.count("irgen")) {
-    irgen::IRGenerator ir_generator;
+  if (vm.count("irgen") || vm.count("run")) {
+    irgen::IRGenerator ir_generator(vm.count("alloc-sites") > 0);
     ir_generator.generate_program(main);
 
-    if (vm.count("dump-ir")) {
-      ir_generator.print_ir(&std::cout);
+    if (vm.count("emit-obj")) {
+      if (!jobs)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+      std::unique_ptr<llvm::Module> module = ir_generator.take_module();
+      const std::string prefix = output_file == "-" ? "a" : output_file;
+      if (vm.count("cache-dir")) {
+        codegen::CacheStats stats;
+        codegen::compile_objects_cached(std::move(module), prefix, runtime_bc,
+                                        cache_dir, cache_size << 20, jobs,
+                                        stats);
+        if (vm.count("cache-stats"))
+          std::cerr << "cache: " << stats.hits << " hits, " << stats.misses
+                    << " misses, " << stats.bytes_reused << " bytes reused, "
+                    << stats.bytes_stored << " bytes stored" << std::endl;
+      } else {
+        if (!partitions)
+          partitions = codegen::default_partitions(*module);
+        codegen::compile_objects(std::move(module), prefix, runtime_bc,
+                                 partitions, jobs);
+      }
+    } else if (vm.count("emit-bc")) {
+      ir_generator.write_bitcode(output_file);
+    } else if (vm.count("dump-ir")) {
+      ir_generator.print_ir(output_file);
+    }
+
+    if (vm.count("run")) {
+      status = jit::run(ir_generator.take_context(),
+                        ir_generator.take_module(), vm.count("lazy") > 0);
     }
   }
 
@@ -83,5 +165,5 @@ int main(int argc, char **argv) {
     dumper.nl();
   }
   delete parser_driver.result_ast;
-  return 0;
+  return status;
 }
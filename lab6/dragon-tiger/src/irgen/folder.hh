@@ -0,0 +1,39 @@
+#ifndef FOLDER_HH
+#define FOLDER_HH
+
+#include <string>
+#include <unordered_map>
+
+#include "../ast/nodes.hh"
+
+namespace irgen {
+using namespace ast;
+
+// Value of a constant expression, either an integer or a string.
+struct Constant {
+  Type type;
+  int32_t integer;
+  std::string string;
+};
+
+// Evaluator of the typed AST expressions whose value is known at
+// compile time: literals, integer arithmetic and comparisons, and
+// calls to side-effect free primitives on constant arguments. It
+// follows the semantics of the runtime, and does not fold expressions
+// which fail at run time (e.g. out of bounds substrings or division
+// by zero), so that they still fail when executed.
+class Folder {
+  // Results already computed, including failures.
+  std::unordered_map<const Expr *, optional<Constant>> folded;
+
+  optional<Constant> evaluate(const Expr &);
+  optional<Constant> evaluate_call(const FunCall &);
+
+public:
+  // Return the value of an expression, if it is constant.
+  optional<Constant> fold(const Expr &);
+};
+
+} // namespace irgen
+
+#endif // FOLDER_HH
@@ -2,21 +2,29 @@
 #define IRGEN_HH
 
 #include <deque>
-#include <ostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "../ast/nodes.hh"
+#include "folder.hh"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
 
 namespace irgen {
 using namespace ast::types;
 
 class IRGenerator : public ConstASTValueVisitor {
   // Hold the core "global" data of LLVM's core infrastructure,
-  // including the type and constant uniquing tables.
-  llvm::LLVMContext Context;
+  // including the type and constant uniquing tables. It is
+  // heap-allocated so that it can be handed over to the JIT
+  // together with the module.
+  std::unique_ptr<llvm::LLVMContext> Context;
 
   // Builder to insert instructions into a basic block.
   llvm::IRBuilder<> Builder;
@@ -24,19 +32,31 @@ class IRGenerator : public ConstASTValueVisitor {
   // Module generated by this tiger program compilation.
   std::unique_ptr<llvm::Module> Mod;
 
+  // Type of Tiger strings: their length followed by their
+  // NUL-terminated bytes. Strings are handled through pointers
+  // to this type, which must match the runtime layout. Strings
+  // of at most 7 bytes are instead encoded in the pointer value
+  // itself, as a tagged immediate (see runtime.c).
+  llvm::StructType *StringTy;
+
   // Current function being generated.
   llvm::Function *current_function;
   const FunDecl *current_function_decl;
 
+  // The following tables are keyed by AST nodes, which live as long
+  // as the generator. They are shared by all the functions of the
+  // program and never need to be cleared, and DenseMap keeps them
+  // cheap on programs with many declarations.
+
   // Map variable declarations (including function parameters)
   // to LLVM values. Those values might refer to the current
   // function frame if they are escaping, or to
   // alloca-declared variables if they are not escaping.
-  std::map<const VarDecl *, llvm::Value *> allocations;
+  llvm::DenseMap<const VarDecl *, llvm::Value *> allocations;
 
   // Map loops to their exit blocks, so that early exits can
   // be easily processed.
-  std::map<const Loop *, llvm::BasicBlock *> loop_exit_bbs;
+  llvm::DenseMap<const Loop *, llvm::BasicBlock *> loop_exit_bbs;
 
   // List of functions to be processed after the current one.
   // This is necessary because in Tiger we might encounter
@@ -46,16 +66,57 @@ class IRGenerator : public ConstASTValueVisitor {
   // generation before handling the next one.
   std::deque<const FunDecl *> pending_func_bodies;
 
-  // Map escaping variables to their position into the current
+  // Map escaping variables to their position into their
   // function frame.
-  std::map<const VarDecl *, int> frame_position;
+  llvm::DenseMap<const VarDecl *, int> frame_position;
 
   // Map function declarations to their specific frame types.
-  std::map<const FunDecl *, llvm::StructType *> frame_type;
+  llvm::DenseMap<const FunDecl *, llvm::StructType *> frame_type;
 
   // Frame of the current function.
   llvm::Value *frame;
 
+  // Pool of the string literals of the module. Each literal is
+  // emitted only once, whatever the number of its occurrences.
+  std::unordered_map<Symbol, llvm::Constant *> string_literals;
+
+  // Return a pointer to the pooled global holding a string literal.
+  llvm::Constant *string_literal(const Symbol &value);
+
+  // Evaluator of the expressions known at compile time, which are
+  // generated as constants.
+  Folder folder;
+  llvm::Constant *constant(const Constant &value);
+
+  // Read the character at position i of s.
+  llvm::Value *generate_char_at(const Expr &s, const Expr &i);
+
+  // Compare two strings for equality, with the common cases inline.
+  llvm::Value *generate_string_eq(llvm::Value *l, llvm::Value *r);
+
+  // Print the pieces of a concatenation without building it.
+  void generate_printv(const std::vector<const Expr *> &pieces);
+
+  // Make the string literals canonical for a program using intern.
+  void generate_interned_literals(llvm::Function &main);
+
+  // Whether calls to primitives building strings record their call
+  // site for the runtime allocation statistics, and the locations of
+  // the sites numbered so far, site i being at alloc_site_names[i - 1].
+  const bool alloc_sites;
+  std::vector<std::string> alloc_site_names;
+
+  // Number the site of a call and store it for the runtime.
+  void generate_alloc_site(const FunCall &call);
+
+  // Give the site locations to the runtime at the start of main.
+  void generate_alloc_site_names(llvm::Function &main);
+
+  // Delimit a region of temporary strings, which are all freed by the
+  // runtime on exit. Strings allocated in it must not outlive it.
+  llvm::Value *enter_region();
+  void exit_region(llvm::Value *outer);
+
   // Generate the LLVM IR code corresponding to a function
   // declaration. If inner function declarations are encountered,
   // they will be stored into pending_func_bodies for later
@@ -93,16 +154,32 @@ class IRGenerator : public ConstASTValueVisitor {
   // in an outer scope.
   llvm::Value *address_of(const Identifier &id);
 
+  // Open an output file for the module ("-" for the standard output).
+  // Errors are fatal.
+  std::unique_ptr<llvm::raw_fd_ostream> open_output(const std::string &filename,
+                                                    bool binary);
+
 public:
-  // Constructor
-  IRGenerator();
+  // Constructor. With alloc_sites, the generated code tells the
+  // runtime where its string allocations come from.
+  explicit IRGenerator(bool alloc_sites = false);
 
   // Given the main function declaration, generate the LLVM IR
   // corresponding to the whole program.
   void generate_program(FunDecl *);
 
-  // Print the generated IR.
-  void print_ir(std::ostream *);
+  // Print the generated IR into a file ("-" for the standard output).
+  void print_ir(const std::string &filename);
+
+  // Write the generated module as LLVM bitcode into a file
+  // ("-" for the standard output).
+  void write_bitcode(const std::string &filename);
+
+  // Give up the ownership of the generated module and of the
+  // context it lives in, e.g. to hand them over to the JIT.
+  // The generator must not be used once they have been taken.
+  std::unique_ptr<llvm::Module> take_module();
+  std::unique_ptr<llvm::LLVMContext> take_context();
 
   // Generate the IR corresponding to those AST nodes.
   // Those methods will return either nullptr when no
@@ -0,0 +1,109 @@
+#include "jit.hh"
+#include "../runtime/posix/runtime.h"
+#include "../utils/errors.hh"
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/TargetSelect.h"
+
+using utils::error;
+
+namespace {
+
+// Addresses of the runtime primitives the generated code may call, and
+// of the variables it may use. Every function and variable declared in
+// runtime.h must be listed here.
+const std::pair<const char *, void *> runtime_symbols[] = {
+    {"__print_err", reinterpret_cast<void *>(&__print_err)},
+    {"__print", reinterpret_cast<void *>(&__print)},
+    {"__printv", reinterpret_cast<void *>(&__printv)},
+    {"__print_int", reinterpret_cast<void *>(&__print_int)},
+    {"__flush", reinterpret_cast<void *>(&__flush)},
+    {"__getchar", reinterpret_cast<void *>(&__getchar)},
+    {"__read_line", reinterpret_cast<void *>(&__read_line)},
+    {"__read_all", reinterpret_cast<void *>(&__read_all)},
+    {"__clock_ns", reinterpret_cast<void *>(&__clock_ns)},
+    {"__cycles", reinterpret_cast<void *>(&__cycles)},
+    {"__ord", reinterpret_cast<void *>(&__ord)},
+    {"__char_at", reinterpret_cast<void *>(&__char_at)},
+    {"__chr", reinterpret_cast<void *>(&__chr)},
+    {"__int_to_string", reinterpret_cast<void *>(&__int_to_string)},
+    {"__string_to_int", reinterpret_cast<void *>(&__string_to_int)},
+    {"__size", reinterpret_cast<void *>(&__size)},
+    {"__substring", reinterpret_cast<void *>(&__substring)},
+    {"__concat", reinterpret_cast<void *>(&__concat)},
+    {"__strcmp", reinterpret_cast<void *>(&__strcmp)},
+    {"__streq", reinterpret_cast<void *>(&__streq)},
+    {"__intern", reinterpret_cast<void *>(&__intern)},
+    {"__intern_literals", reinterpret_cast<void *>(&__intern_literals)},
+    {"__region_enter", reinterpret_cast<void *>(&__region_enter)},
+    {"__region_exit", reinterpret_cast<void *>(&__region_exit)},
+    {"__alloc_site", reinterpret_cast<void *>(&__alloc_site)},
+    {"__alloc_sites", reinterpret_cast<void *>(&__alloc_sites)},
+    {"__not", reinterpret_cast<void *>(&__not)},
+    {"__exit", reinterpret_cast<void *>(&__exit)},
+};
+
+void check(llvm::Error err) {
+  if (err)
+    error("jit: " + llvm::toString(std::move(err)));
+}
+
+template <typename T> T check(llvm::Expected<T> value) {
+  if (!value)
+    error("jit: " + llvm::toString(value.takeError()));
+  return std::move(*value);
+}
+
+// Called through the lazy compilation stubs when a function body
+// cannot be materialized.
+void lazy_compilation_failure() { error("jit: lazy compilation failed"); }
+
+void define_runtime_symbols(llvm::orc::LLJIT &J) {
+  for (auto &symbol : runtime_symbols)
+    check(J.defineAbsolute(
+        symbol.first,
+        llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(symbol.second),
+                                 llvm::JITSymbolFlags::Exported)));
+}
+
+} // namespace
+
+namespace jit {
+
+int run(std::unique_ptr<llvm::LLVMContext> context,
+        std::unique_ptr<llvm::Module> module, bool lazy) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  auto JTMB = check(llvm::orc::JITTargetMachineBuilder::detectHost());
+  auto DL = check(JTMB.getDefaultDataLayoutForTarget());
+  module->setDataLayout(DL);
+  llvm::orc::ThreadSafeModule TSM(std::move(module), std::move(context));
+
+  std::unique_ptr<llvm::orc::LLJIT> J;
+  if (lazy) {
+    // Every Tiger function is a separate LLVM function named after
+    // its external name. Partitioning on the requested symbols only
+    // makes each of them compiled the first time it is called.
+    auto LJ = check(llvm::orc::LLLazyJIT::Create(
+        std::move(JTMB), std::move(DL),
+        llvm::pointerToJITTargetAddress(&lazy_compilation_failure)));
+    LJ->setPartitionFunction(
+        llvm::orc::CompileOnDemandLayer::compileRequested);
+    define_runtime_symbols(*LJ);
+    check(LJ->addLazyIRModule(std::move(TSM)));
+    J = std::move(LJ);
+  } else {
+    J = check(llvm::orc::LLJIT::Create(std::move(JTMB), std::move(DL)));
+    define_runtime_symbols(*J);
+    check(J->addIRModule(std::move(TSM)));
+  }
+
+  auto main_symbol = check(J->lookup("main"));
+  auto main = reinterpret_cast<int32_t (*)()>(
+      static_cast<uintptr_t>(main_symbol.getAddress()));
+  return main();
+}
+
+} // namespace jit
@@ -0,0 +1,24 @@
+#ifndef JIT_HH
+#define JIT_HH
+
+#include <memory>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+namespace jit {
+
+// Compile the module in memory with LLVM ORC and run its main
+// function right away. Calls to the runtime primitives (__print,
+// __concat, etc.) are resolved against the copy of the POSIX runtime
+// linked into dtiger, so no assembler, linker or executable is
+// involved. When lazy is set, each function is only compiled the
+// first time it is called, so that startup time depends on the code
+// actually executed rather than on the program size. Return the exit
+// status of the Tiger program.
+int run(std::unique_ptr<llvm::LLVMContext> context,
+        std::unique_ptr<llvm::Module> module, bool lazy = false);
+
+} // namespace jit
+
+#endif // JIT_HH
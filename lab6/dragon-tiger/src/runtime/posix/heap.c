@@ -0,0 +1,515 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "heap.h"
+
+// Chunks are CHUNK_SIZE bytes (less if the heap limit is close),
+// aligned on CHUNK_SIZE so that the chunk of an address is found by
+// masking it. They start with a bitmap of the object starts, one bit
+// per HEAP_ALIGN bytes, which lets the collector find the object an
+// interior pointer points into.
+#define CHUNK_SIZE ((size_t) 4 << 20)
+#define CHUNK_WORDS (CHUNK_SIZE / HEAP_ALIGN / 64)
+
+struct chunk {
+  size_t size;
+  uint64_t starts[CHUNK_WORDS];
+  char data[];
+};
+
+// Objects bigger than LARGE_SIZE get a mapping of their own.
+#define LARGE_SIZE (CHUNK_SIZE / 4)
+
+// Free gaps smaller than MIN_HOLE are not worth allocating into; they
+// are left alone until their neighbours die.
+#define MIN_HOLE 256
+
+// The collector runs once at least GC_MIN bytes, and at least as many
+// as survived the previous collection, have been allocated since then.
+#define GC_MIN ((size_t) 8 << 20)
+
+// Top of the stack of the main thread, as recorded by the C library.
+extern void *__libc_stack_end;
+
+struct region {
+  char *start;
+  char *end;
+};
+
+char *__heap_next;
+char *__heap_limit;
+
+// Start of the current hole, of the innermost region and end of the
+// last retained object of the current hole.
+static char *hole_start, *region_start, *hole_floor;
+
+// Chunks and large objects, sorted by address.
+static struct chunk **chunks;
+static size_t chunks_count, chunks_capacity;
+static struct heap_header **large;
+static size_t large_count, large_capacity;
+
+// Holes left by the last collection, in address order, and the next
+// one to allocate into.
+static struct region *holes;
+static size_t holes_count, holes_capacity, next_hole;
+
+// Parts of holes allocated into since the last collection.
+static struct region *used;
+static size_t used_count, used_capacity;
+
+// Chunks found empty by the sweep.
+static struct chunk **empty;
+static size_t empty_count, empty_capacity;
+
+// Global variables registered as roots.
+static void *const **roots;
+static size_t roots_count, roots_capacity;
+
+// Scanned objects marked but not scanned yet.
+static struct heap_header **pending;
+static size_t pending_count, pending_capacity;
+
+// Bytes mapped, allowed (0 for no limit), at most mapped, live after
+// the last collection, allocated since then and allocated before.
+static size_t heap_size, heap_max, heap_peak, live_size, allocated,
+    allocated_before;
+
+static unsigned collections;
+static double total_pause, max_pause;
+static int heap_initialized;
+
+__attribute__((noreturn))
+static void heap_error(const char *msg, size_t size) {
+  fprintf(stderr, msg, size);
+  exit(EXIT_FAILURE);
+}
+
+static void *grow(void *items, size_t *capacity, size_t size) {
+  *capacity = *capacity ? 2 * *capacity : 64;
+  items = realloc(items, *capacity * size);
+  if (items == NULL)
+    heap_error("out of memory\n", 0);
+  return items;
+}
+
+#define PUSH(array, value)                                                  \
+  do {                                                                      \
+    if (array##_count == array##_capacity)                                  \
+      array = grow(array, &array##_capacity, sizeof(*array));               \
+    array[array##_count++] = (value);                                       \
+  } while (0)
+
+// Insert the last element of a sorted array of pointers at its place.
+static void sort_last(void **array, size_t count) {
+  void *p = array[count - 1];
+  size_t i = count - 1;
+  for (; i > 0 && array[i - 1] > p; i--)
+    array[i] = array[i - 1];
+  array[i] = p;
+}
+
+static void print_stats(void) {
+  fprintf(stderr,
+          "gc: %u collections, %.3f ms total pause, %.3f ms max pause\n"
+          "gc: heap size %zu KiB (peak %zu KiB), %zu KiB live after the "
+          "last collection\n",
+          collections, total_pause * 1e3, max_pause * 1e3, heap_size >> 10,
+          heap_peak >> 10, live_size >> 10);
+}
+
+static void heap_init(void) {
+  const char *limit = getenv("TIGER_HEAP_LIMIT");
+  heap_initialized = 1;
+  if (getenv("TIGER_GC_STATS") != NULL)
+    atexit(print_stats);
+  if (limit == NULL)
+    return;
+
+  char *end;
+  int shift = 0;
+  errno = 0;
+  unsigned long long value = strtoull(limit, &end, 10);
+  switch (*end) {
+  case 'G': case 'g': shift += 10; // fall through
+  case 'M': case 'm': shift += 10; // fall through
+  case 'K': case 'k': shift += 10; end++; break;
+  default: break;
+  }
+  // A heap_max of 0 means no limit, so a limit of 0 is rejected like a
+  // sign or a value which does not fit, rather than silently ignored.
+  if (!isdigit((unsigned char) *limit) || *end != '\0' || errno == ERANGE ||
+      value == 0 || value > (SIZE_MAX >> shift))
+    heap_error("invalid TIGER_HEAP_LIMIT value\n", 0);
+  heap_max = value << shift;
+}
+
+__attribute__((noreturn))
+static void limit_exceeded(void) {
+  heap_error("string heap limit of %zu bytes exceeded "
+             "(set TIGER_HEAP_LIMIT to raise it)\n", heap_max);
+}
+
+// Return whether size more bytes can be mapped without exceeding the
+// heap limit.
+static int fits(size_t size) {
+  return !heap_max || size <= heap_max - heap_size;
+}
+
+static void *map(size_t size) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    heap_error("out of memory (%zu bytes requested)\n", size);
+  return p;
+}
+
+static void add_heap_size(size_t size) {
+  heap_size += size;
+  if (heap_size > heap_peak)
+    heap_peak = heap_size;
+}
+
+//
+// Allocation
+//
+
+static void add_hole(char *start, char *end) {
+  if (end - start >= MIN_HOLE)
+    PUSH(holes, ((struct region) {start, end}));
+}
+
+// Stop allocating into the current hole.
+static void close_hole(void) {
+  if (__heap_next != hole_start) {
+    PUSH(used, ((struct region) {hole_start, __heap_next}));
+    allocated += __heap_next - hole_start;
+  }
+  hole_start = __heap_next = __heap_limit = hole_floor = NULL;
+}
+
+// Move to the next hole of at least size bytes, if any.
+static int take_hole(size_t size) {
+  close_hole();
+  while (next_hole < holes_count) {
+    struct region *r = &holes[next_hole++];
+    if ((size_t) (r->end - r->start) >= size) {
+      hole_start = __heap_next = hole_floor = r->start;
+      __heap_limit = r->end;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Map a new chunk, which becomes the last hole. Return 0 if the heap
+// limit leaves no room for an object of size bytes.
+static int new_chunk(size_t size) {
+  size_t chunk_size = CHUNK_SIZE;
+  if (!fits(chunk_size)) {
+    chunk_size = (heap_max - heap_size) & ~(size_t) 4095;
+    if (chunk_size < sizeof(struct chunk) + size)
+      return 0;
+  }
+
+  // Over-allocate to align the chunk on CHUNK_SIZE.
+  char *p = (char *) map(2 * CHUNK_SIZE);
+  char *start = (char *) (((uintptr_t) p + CHUNK_SIZE - 1) &
+                          ~(uintptr_t) (CHUNK_SIZE - 1));
+  if (start > p)
+    munmap(p, start - p);
+  munmap(start + chunk_size, p + 2 * CHUNK_SIZE - (start + chunk_size));
+  add_heap_size(chunk_size);
+
+  struct chunk *c = (struct chunk *) start;
+  c->size = chunk_size;
+  PUSH(chunks, c);
+  sort_last((void **) chunks, chunks_count);
+  add_hole(c->data, start + chunk_size);
+  return 1;
+}
+
+static void collect(void);
+
+// Whether enough has been allocated since the last collection.
+static int collection_due(void) {
+  return allocated + (__heap_next - hole_start) >=
+         (live_size > GC_MIN ? live_size : GC_MIN);
+}
+
+static struct heap_header *alloc_small(size_t size) {
+  if (!take_hole(size)) {
+    if (collection_due() || !fits(CHUNK_SIZE)) {
+      collect();
+      if (take_hole(size))
+        goto found;
+    }
+    if (!new_chunk(size))
+      limit_exceeded();
+    take_hole(size);
+  }
+found:;
+  struct heap_header *h = (struct heap_header *) __heap_next;
+  __heap_next += size;
+  return h;
+}
+
+static struct heap_header *alloc_large(size_t size) {
+  if (collection_due() || !fits(size))
+    collect();
+  if (!fits(size))
+    limit_exceeded();
+
+  struct heap_header *h = (struct heap_header *) map(size);
+  add_heap_size(size);
+  PUSH(large, h);
+  sort_last((void **) large, large_count);
+  allocated += size;
+  return h;
+}
+
+size_t heap_allocated(void) {
+  return allocated_before + allocated + (__heap_next - hole_start);
+}
+
+void *__heap_alloc_slow(size_t size, int scanned) {
+  if (!heap_initialized)
+    heap_init();
+
+  struct heap_header *h =
+      size > LARGE_SIZE ? alloc_large(size) : alloc_small(size);
+  h->size = size;
+  h->scanned = scanned;
+  h->marked = 0;
+  return h + 1;
+}
+
+//
+// Regions
+//
+
+// Return whether p was allocated in the current hole since the start
+// of the innermost region.
+static int in_region(const void *p) {
+  return region_start >= hole_start && (const char *) p >= region_start &&
+         (const char *) p < __heap_next;
+}
+
+char *heap_enter_region(void) {
+  char *outer = region_start;
+  region_start = __heap_next;
+  return outer;
+}
+
+void heap_exit_region(char *outer) {
+  char *start = region_start;
+  region_start = outer;
+  if (start >= hole_start && start <= __heap_next)
+    __heap_next = start > hole_floor ? start : hole_floor;
+}
+
+void heap_retain(const void *holder) {
+  if (!in_region(holder))
+    hole_floor = __heap_next;
+}
+
+//
+// Collection
+//
+
+static void set_start(struct heap_header *h) {
+  struct chunk *c =
+      (struct chunk *) ((uintptr_t) h & ~(uintptr_t) (CHUNK_SIZE - 1));
+  size_t index = ((char *) h - (char *) c) / HEAP_ALIGN;
+  c->starts[index / 64] |= (uint64_t) 1 << (index % 64);
+}
+
+static int is_chunk(struct chunk *c) {
+  size_t low = 0, high = chunks_count;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if (chunks[mid] == c)
+      return 1;
+    if (chunks[mid] < c)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return 0;
+}
+
+// Return the object containing address p, or NULL if p does not point
+// into the heap.
+static struct heap_header *find_object(uintptr_t p) {
+  struct chunk *c =
+      (struct chunk *) (p & ~(uintptr_t) (CHUNK_SIZE - 1));
+  if (is_chunk(c)) {
+    size_t index = (p - (uintptr_t) c) / HEAP_ALIGN;
+    if (p < (uintptr_t) c->data || p >= (uintptr_t) c + c->size)
+      return NULL;
+    // Look for the closest start before p, no further than the
+    // biggest object a chunk can hold.
+    size_t w = index / 64, first = (LARGE_SIZE / HEAP_ALIGN) / 64;
+    first = w > first ? w - first : 0;
+    uint64_t bits = c->starts[w] & (~(uint64_t) 0 >> (63 - index % 64));
+    while (bits == 0) {
+      if (w == first)
+        return NULL;
+      bits = c->starts[--w];
+    }
+    struct heap_header *h = (struct heap_header *) (
+        (char *) c + (w * 64 + 63 - __builtin_clzll(bits)) * HEAP_ALIGN);
+    return p < (uintptr_t) h + h->size ? h : NULL;
+  }
+
+  size_t low = 0, high = large_count;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if ((uintptr_t) large[mid] <= p)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low == 0)
+    return NULL;
+  struct heap_header *h = large[low - 1];
+  return p < (uintptr_t) h + h->size ? h : NULL;
+}
+
+// Mark every object pointed to by an aligned word of [start, end).
+static void scan(char *start, char *end) {
+  uintptr_t *p = (uintptr_t *) (((uintptr_t) start + sizeof(uintptr_t) - 1) &
+                                ~(uintptr_t) (sizeof(uintptr_t) - 1));
+  for (; (char *) p + sizeof(uintptr_t) <= end; p++) {
+    struct heap_header *h = find_object(*p);
+    if (h == NULL || h->marked)
+      continue;
+    h->marked = 1;
+    if (h->scanned)
+      PUSH(pending, h);
+  }
+}
+
+static void mark_pending(void) {
+  while (pending_count > 0) {
+    struct heap_header *h = pending[--pending_count];
+    scan((char *) (h + 1), (char *) h + h->size);
+  }
+}
+
+__attribute__((noinline))
+static void mark_stack(void) {
+  scan((char *) __builtin_frame_address(0), (char *) __libc_stack_end);
+  mark_pending();
+}
+
+void heap_add_root(void *const *root) {
+  PUSH(roots, root);
+}
+
+// Spill the callee-saved registers, which may hold the only pointer to
+// an object, before scanning the stack.
+__attribute__((noinline))
+static void mark_roots(void) {
+  __builtin_unwind_init();
+  for (size_t i = 0; i < roots_count; i++)
+    scan((char *) roots[i], (char *) (roots[i] + 1));
+  mark_stack();
+}
+
+// Free the unmarked objects and collect the gaps between the remaining
+// ones as holes. Chunks left empty are unmapped, unless they are needed
+// to allocate until the next collection.
+static void sweep(void) {
+  size_t kept = 0;
+  empty_count = 0;
+  holes_count = next_hole = 0;
+  live_size = 0;
+
+  for (size_t i = 0; i < chunks_count; i++) {
+    struct chunk *c = chunks[i];
+    char *free = c->data;
+    size_t first_hole = holes_count;
+    for (size_t w = 0; w < CHUNK_WORDS; w++) {
+      for (uint64_t bits = c->starts[w]; bits != 0; bits &= bits - 1) {
+        int b = __builtin_ctzll(bits);
+        struct heap_header *h =
+            (struct heap_header *) ((char *) c + (w * 64 + b) * HEAP_ALIGN);
+        if (!h->marked) {
+          c->starts[w] &= ~((uint64_t) 1 << b);
+          continue;
+        }
+        h->marked = 0;
+        add_hole(free, (char *) h);
+        free = (char *) h + h->size;
+        live_size += h->size;
+      }
+    }
+    if (free == c->data) {
+      holes_count = first_hole;
+      PUSH(empty, c);
+      continue;
+    }
+    add_hole(free, (char *) c + c->size);
+    chunks[kept++] = c;
+  }
+  chunks_count = kept;
+
+  kept = 0;
+  for (size_t i = 0; i < large_count; i++) {
+    struct heap_header *h = large[i];
+    if (!h->marked) {
+      heap_size -= h->size;
+      munmap(h, h->size);
+      continue;
+    }
+    h->marked = 0;
+    live_size += h->size;
+    large[kept++] = h;
+  }
+  large_count = kept;
+
+  size_t needed = live_size + (live_size > GC_MIN ? live_size : GC_MIN);
+  for (size_t i = 0; i < empty_count; i++) {
+    struct chunk *c = empty[i];
+    if (heap_size - c->size >= needed) {
+      heap_size -= c->size;
+      munmap(c, c->size);
+    } else {
+      add_hole(c->data, (char *) c + c->size);
+      PUSH(chunks, c);
+      sort_last((void **) chunks, chunks_count);
+    }
+  }
+}
+
+static void collect(void) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // Record the start of every object allocated since the last
+  // collection: they lie back to back in the holes allocated into.
+  close_hole();
+  for (size_t i = 0; i < used_count; i++)
+    for (char *p = used[i].start; p < used[i].end;
+         p += ((struct heap_header *) p)->size)
+      set_start((struct heap_header *) p);
+  used_count = 0;
+  allocated_before += allocated;
+  allocated = 0;
+
+  mark_roots();
+  sweep();
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double pause = (end.tv_sec - start.tv_sec) +
+                 (end.tv_nsec - start.tv_nsec) / 1e9;
+  collections++;
+  total_pause += pause;
+  if (pause > max_pause)
+    max_pause = pause;
+}
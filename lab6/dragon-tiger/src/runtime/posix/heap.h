@@ -0,0 +1,89 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Strings are allocated from a heap made of large mmap'ed chunks, with
+// a bump pointer into the current free hole of a chunk. Unreachable
+// objects are reclaimed by a conservative mark-and-sweep collector:
+// the machine stack (which holds the Tiger frames and every other
+// alloca) and the registers are scanned for anything that looks like a
+// pointer into the heap, and objects allocated with heap_alloc_scanned
+// are scanned the same way. Objects never move, and pointers to the
+// inside of an object keep it alive.
+//
+// The total size of the heap can be capped with the TIGER_HEAP_LIMIT
+// environment variable, a positive number of bytes with an optional K,
+// M or G suffix (anything else is a fatal error). The collector runs
+// before going over it, and running out of room anyway is a fatal
+// runtime error. Setting TIGER_GC_STATS prints collection statistics
+// on standard error at exit.
+
+// Every allocation is aligned on HEAP_ALIGN bytes, which keeps the low
+// bits of string addresses free for tagging.
+#define HEAP_ALIGN 8
+
+// Every object is preceded by its total size, header included, and by
+// the collector flags.
+struct heap_header {
+  uint32_t size;
+  uint8_t scanned;
+  uint8_t marked;
+};
+
+_Static_assert(sizeof(struct heap_header) == HEAP_ALIGN,
+               "heap headers must keep objects aligned");
+
+// Bump pointer and end of the current hole. They are exported so that
+// the fast path below can be inlined in generated code as well.
+extern char *__heap_next;
+extern char *__heap_limit;
+
+// Allocate an object of size bytes (header included and aligned) when
+// the current hole is exhausted.
+void *__heap_alloc_slow(size_t size, int scanned);
+
+static inline void *heap_alloc_object(size_t size, int scanned) {
+  size = (sizeof(struct heap_header) + size + HEAP_ALIGN - 1) &
+         ~(size_t) (HEAP_ALIGN - 1);
+  char *p = __heap_next;
+  if ((size_t) (__heap_limit - p) < size)
+    return __heap_alloc_slow(size, scanned);
+  __heap_next = p + size;
+  struct heap_header *h = (struct heap_header *) p;
+  h->size = size;
+  h->scanned = scanned;
+  h->marked = 0;
+  return h + 1;
+}
+
+// Allocate size bytes which never hold pointers to the heap.
+static inline void *heap_alloc(size_t size) {
+  return heap_alloc_object(size, 0);
+}
+
+// Allocate size bytes whose aligned words are scanned for pointers.
+static inline void *heap_alloc_scanned(size_t size) {
+  return heap_alloc_object(size, 1);
+}
+
+// Return the number of bytes allocated so far, headers included, less
+// those freed by heap_exit_region.
+size_t heap_allocated(void);
+
+// Register a global variable pointing to the heap as a root.
+void heap_add_root(void *const *root);
+
+// Regions of temporary objects. heap_enter_region starts a region and
+// returns the enclosing one, to be given back to heap_exit_region,
+// which frees the objects allocated since, as far as they lie in the
+// current hole; they must all be dead by then. An object allocated
+// inside a region but referenced by an object outside it (such as the
+// memoized flattening of an older rope) is protected by calling
+// heap_retain with the referencing object right after allocating it.
+char *heap_enter_region(void);
+void heap_exit_region(char *outer);
+void heap_retain(const void *holder);
+
+#endif // HEAP_H
@@ -0,0 +1,45 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "input.h"
+
+#define IN_SIZE (256 << 10)
+
+static char in_buffer[IN_SIZE] __attribute__((aligned(64)));
+static size_t in_start, in_end;
+
+// Refill the buffer if it is empty, and return the number of bytes
+// available.
+static size_t in_fill(void) {
+  if (in_start < in_end)
+    return in_end - in_start;
+
+  ssize_t n;
+  do
+    n = read(STDIN_FILENO, in_buffer, IN_SIZE);
+  while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    perror("cannot read standard input");
+    exit(EXIT_FAILURE);
+  }
+  in_start = 0;
+  in_end = n;
+  return n;
+}
+
+int in_getc(void) {
+  if (in_start == in_end && in_fill() == 0)
+    return EOF;
+  return (unsigned char) in_buffer[in_start++];
+}
+
+const char *in_peek(size_t *length) {
+  *length = in_fill();
+  return in_buffer + in_start;
+}
+
+void in_skip(size_t length) {
+  in_start += length;
+}
@@ -0,0 +1,20 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+// Standard input is read by the runtime rather than by stdio, into a
+// large buffer filled with read(2), so that bulk reads can take bytes
+// straight out of it.
+
+// Return the next byte of standard input, or EOF at end of input.
+int in_getc(void);
+
+// Return the buffered bytes of standard input and set *length to their
+// count, reading more if there are none. *length is 0 at end of input.
+const char *in_peek(size_t *length);
+
+// Consume length bytes returned by in_peek.
+void in_skip(size_t length);
+
+#endif // INPUT_H
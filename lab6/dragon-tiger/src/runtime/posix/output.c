@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+
+#define OUT_SIZE (64 << 10)
+
+static char out_buffer[OUT_SIZE] __attribute__((aligned(64)));
+static size_t out_length;
+static int out_terminal;
+
+// Decimal representations of 0 to 99, used to convert integers two
+// digits at a time.
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void write_all(const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(STDOUT_FILENO, data, length);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      // Drop the buffer so that flushing at exit does not fail again.
+      out_length = 0;
+      perror("cannot write to standard output");
+      exit(EXIT_FAILURE);
+    }
+    data += n;
+    length -= n;
+  }
+}
+
+void out_flush(void) {
+  size_t length = out_length;
+  out_length = 0;
+  write_all(out_buffer, length);
+}
+
+__attribute__((constructor))
+static void out_init(void) {
+  out_terminal = isatty(STDOUT_FILENO);
+  atexit(out_flush);
+}
+
+void out_write(const char *data, size_t length) {
+  if (length > OUT_SIZE - out_length) {
+    out_flush();
+    if (length >= OUT_SIZE) {
+      write_all(data, length);
+      return;
+    }
+  }
+  memcpy(out_buffer + out_length, data, length);
+  out_length += length;
+  if (out_terminal)
+    out_flush();
+}
+
+size_t format_int(char *buf, int32_t i) {
+  uint32_t u = i < 0 ? -(uint32_t) i : (uint32_t) i;
+  size_t digits = 1 + (u >= 10) + (u >= 100) + (u >= 1000) +
+                  (u >= 10000) + (u >= 100000) + (u >= 1000000) +
+                  (u >= 10000000) + (u >= 100000000) + (u >= 1000000000);
+  char *p = buf;
+  *p = '-';
+  p += i < 0;
+  size_t length = p + digits - buf;
+
+  // Fill in the digits from the end, two at a time.
+  p += digits;
+  while (u >= 100) {
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * (u % 100), 2);
+    u /= 100;
+  }
+  if (u >= 10)
+    memcpy(p - 2, digit_pairs + 2 * u, 2);
+  else
+    p[-1] = '0' + u;
+  return length;
+}
+
+void out_int(int32_t i) {
+  if (OUT_SIZE - out_length < INT_MAX_DIGITS)
+    out_flush();
+
+  out_length += format_int(out_buffer + out_length, i);
+
+  if (out_terminal)
+    out_flush();
+}
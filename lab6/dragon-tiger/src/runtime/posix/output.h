@@ -0,0 +1,29 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Standard output is buffered by the runtime rather than by stdio:
+// bytes are appended to a large aligned buffer, which is written with
+// write(2) when full, when flushed explicitly, before reading from
+// standard input and at exit. When standard output is a terminal, the
+// buffer is flushed after every write instead.
+
+// Longest decimal representation of a 32 bit integer.
+#define INT_MAX_DIGITS 11
+
+// Write the decimal representation of an integer to buf, which must
+// hold at least INT_MAX_DIGITS bytes, and return its length.
+size_t format_int(char *buf, int32_t i);
+
+// Append bytes to standard output.
+void out_write(const char *data, size_t length);
+
+// Append the decimal representation of an integer to standard output.
+void out_int(int32_t i);
+
+// Write the buffered bytes to standard output.
+void out_flush(void);
+
+#endif // OUTPUT_H
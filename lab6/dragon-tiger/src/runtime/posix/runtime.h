@@ -3,11 +3,22 @@
 
 #include <stdint.h>
 
-// Print a null-terminated string on standard error.
-void __print_err(const char *s);
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-// Print a null-terminated string on standard output.
-void __print(const char *s);
+// A Tiger string: its length followed by its bytes, so that the
+// length is always available in constant time.
+typedef struct string string;
+
+// Print a string on standard error.
+void __print_err(const string *s);
+
+// Print a string on standard output.
+void __print(const string *s);
+
+// Print count strings one after the other on standard output.
+void __printv(const string *const *pieces, int32_t count);
 
 // Print a 32 bit signed integer on standard output.
 void __print_int(int32_t i);
@@ -18,20 +29,55 @@ void __flush(void);
 // Read a char from standard input and return a string
 // containing it. If no char is available (end-of-file),
 // return the empty string.
-const char *__getchar(void);
+const string *__getchar(void);
+
+// Read a line from standard input and return it, including
+// its terminating newline if any. At end-of-file, return the
+// empty string.
+const string *__read_line(void);
+
+// Read standard input up to end-of-file and return it.
+const string *__read_all(void);
+
+// Return the low 32 bits of a monotonic clock in nanoseconds. The
+// difference between two calls is the elapsed time, modulo 2^32, so
+// intervals up to 2 seconds can be measured. Calls are never moved
+// across each other or across memory accesses, but computations
+// whose results are unused may still be optimized away.
+int32_t __clock_ns(void);
+
+// Return the low 32 bits of the CPU timestamp counter, under the same
+// conditions as __clock_ns. Falls back to __clock_ns where there is
+// no such counter.
+int32_t __cycles(void);
 
 // Return the ASCII code of the char in first position
 // in the string, or -1 if the string is empty.
-int32_t __ord(const char *s);
+int32_t __ord(const string *s);
+
+// Return the ASCII code of the char at position i in the
+// string. Bail out with a fatal runtime error if i is out
+// of bounds. Same as __ord(__substring(s, i, 1)), without
+// building the substring.
+int32_t __char_at(const string *s, int32_t i);
 
 // Return a string containing the character whose ASCII
 // code is given as argument. 0 will return the empty
 // string, negative values or values above 255 will
 // bail out with a fatal runtime error.
-const char *__chr(int32_t i);
+const string *__chr(int32_t i);
+
+// Return the decimal representation of an integer.
+const string *__int_to_string(int32_t i);
+
+// Return the integer whose decimal representation is s, with an
+// optional leading minus sign. Bail out with a fatal runtime error
+// if s is not such a representation or if the integer does not fit
+// in 32 bits.
+int32_t __string_to_int(const string *s);
 
 // Return the length of a string.
-int32_t __size(const char *);
+int32_t __size(const string *s);
 
 // Return a substring of s starting at character first
 // with length length. Bail out with a fatal runtime error
@@ -41,16 +87,43 @@ int32_t __size(const char *);
 // Getting an empty substring is possible (length = 0)
 // as long as first + length is not greater than the
 // string length, so __substring("", 0, 0) is acceptable.
-const char *__substring(const char *s, int32_t first, int32_t length);
+const string *__substring(const string *s, int32_t first, int32_t length);
 
 // Concatenate two strings.
-const char *__concat(const char *s1, const char *s2);
+const string *__concat(const string *s1, const string *s2);
 
 // Compare two strings and return -1, 0, or 1.
-int32_t __strcmp(const char *s1, const char *s2);
+int32_t __strcmp(const string *s1, const string *s2);
 
 // Check if two strings are equal and return 0 or 1.
-int32_t __streq(const char *s1, const char *s2);
+int32_t __streq(const string *s1, const string *s2);
+
+// Return the canonical string equal to s, entering s in the intern
+// table if there is none yet. Interned strings compare equal if and
+// only if they are the same pointer, and are never freed.
+const string *__intern(const string *s);
+
+// Enter the string literals of the program in the intern table, so
+// that they are canonical as well. Called at startup by programs
+// using intern.
+void __intern_literals(const string *const *literals, int32_t count);
+
+// Start a region of temporary strings, and return the enclosing one.
+void *__region_enter(void);
+
+// Free the strings allocated since the matching __region_enter, which
+// must all be dead, and go back to the enclosing region.
+void __region_exit(void *outer);
+
+// Call site of the next call to a primitive building strings, stored
+// by programs compiled with --alloc-sites for the allocation
+// statistics (see stats.h). Sites are numbered from 1.
+extern int32_t __alloc_site;
+
+// Give the locations of the call sites of a program compiled with
+// --alloc-sites, as file:line:col, site i being at names[i - 1].
+// Called at startup.
+void __alloc_sites(const char *const *names, int32_t count);
 
 // Logical not, return 0 or 1.
 int32_t __not(int32_t i);
@@ -58,4 +131,8 @@ int32_t __not(int32_t i);
 // Exit to the operating system with the given exit status.
 void __exit(int32_t c);
 
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
 #endif // RUNTIME_H
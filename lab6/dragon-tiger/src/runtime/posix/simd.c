@@ -0,0 +1,98 @@
+#include <stdint.h>
+
+#include "simd.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static size_t mismatch_scalar(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  while (i < n && a[i] == b[i])
+    i++;
+  return i;
+}
+
+#if defined(__x86_64__)
+
+// The vector versions compare whole blocks with unaligned loads. The
+// remaining bytes are compared with one last block overlapping the
+// previous one, or with masked loads, which do not fault on the bytes
+// masked out. They never read past n.
+
+static size_t mismatch_sse2(const char *a, const char *b, size_t n) {
+  if (n < 16)
+    return mismatch_scalar(a, b, n);
+  size_t i = 0;
+  for (;; i += 16) {
+    if (i + 16 > n)
+      i = n - 16;
+    __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+    if (mask)
+      return i + __builtin_ctz(mask);
+    if (i + 16 == n)
+      return n;
+  }
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const char *a, const char *b, size_t n) {
+  if (n < 32)
+    return mismatch_sse2(a, b, n);
+  size_t i = 0;
+  for (;; i += 32) {
+    if (i + 32 > n)
+      i = n - 32;
+    __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+    unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+    if (mask)
+      return i + __builtin_ctz(mask);
+    if (i + 32 == n)
+      return n;
+  }
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2")))
+static size_t mismatch_avx512(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m512i x = _mm512_loadu_si512((const void *) (a + i));
+    __m512i y = _mm512_loadu_si512((const void *) (b + i));
+    uint64_t mask = _mm512_cmpneq_epi8_mask(x, y);
+    if (mask)
+      return i + __builtin_ctzll(mask);
+  }
+  if (i == n)
+    return n;
+  __mmask64 tail = _bzhi_u64(~0ULL, n - i);
+  __m512i x = _mm512_maskz_loadu_epi8(tail, a + i);
+  __m512i y = _mm512_maskz_loadu_epi8(tail, b + i);
+  uint64_t mask = _mm512_cmpneq_epi8_mask(x, y);
+  return mask ? i + __builtin_ctzll(mask) : n;
+}
+
+#endif
+
+size_t (*simd_mismatch)(const char *a, const char *b, size_t n) =
+    mismatch_scalar;
+
+struct simd_kernel simd_kernels[5] = {{"scalar", mismatch_scalar}};
+
+__attribute__((constructor))
+static void select_implementations(void) {
+  int k = 0;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2"))
+    simd_kernels[k++] = (struct simd_kernel){"avx512", mismatch_avx512};
+  if (__builtin_cpu_supports("avx2"))
+    simd_kernels[k++] = (struct simd_kernel){"avx2", mismatch_avx2};
+  simd_kernels[k++] = (struct simd_kernel){"sse2", mismatch_sse2};
+#endif
+  simd_kernels[k++] = (struct simd_kernel){"scalar", mismatch_scalar};
+  simd_kernels[k] = (struct simd_kernel){NULL, NULL};
+  simd_mismatch = simd_kernels[0].mismatch;
+}
@@ -0,0 +1,24 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+
+// Return the index of the first byte differing between a and b, or n
+// if their first n bytes are equal. Never reads beyond the first n
+// bytes of a and b, so it is safe up to the end of a mapped page.
+//
+// The implementation (scalar, SSE2, AVX2 or AVX-512) is selected
+// at startup according to the features of the processor.
+extern size_t (*simd_mismatch)(const char *a, const char *b, size_t n);
+
+// The implementations the processor supports, best first, terminated by
+// an entry with a null name. simd_mismatch is the first one. Tests and
+// benchmarks use this list to exercise each of them.
+struct simd_kernel {
+  const char *name;
+  size_t (*mismatch)(const char *a, const char *b, size_t n);
+};
+
+extern struct simd_kernel simd_kernels[];
+
+#endif // SIMD_H
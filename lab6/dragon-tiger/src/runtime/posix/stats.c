@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "heap.h"
+#include "runtime.h"
+#include "stats.h"
+
+// More than the number of primitives building strings.
+#define MAX_PRIMITIVES 32
+
+struct counters {
+  const char *primitive;
+  uint64_t calls, bytes, ns;
+};
+
+int stats_enabled;
+int32_t __alloc_site;
+
+// Totals by primitive, and by call site (indexed by site id, 0 being
+// unused) with the location of each site.
+static struct counters primitives[MAX_PRIMITIVES];
+static size_t primitives_count;
+static struct counters *sites;
+static const char *const *site_names;
+static size_t sites_count;
+
+static uint64_t now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Sort counters by decreasing number of bytes, then of calls.
+static int compare(const void *a, const void *b) {
+  const struct counters *c1 = *(const struct counters *const *) a;
+  const struct counters *c2 = *(const struct counters *const *) b;
+  if (c1->bytes != c2->bytes)
+    return c1->bytes < c2->bytes ? 1 : -1;
+  return (c1->calls < c2->calls) - (c1->calls > c2->calls);
+}
+
+static void print_row(const char *name, const struct counters *c) {
+  fprintf(stderr, "alloc: %-24s %-16s %12llu %14llu %10.3f\n", name,
+          c->primitive, (unsigned long long) c->calls,
+          (unsigned long long) c->bytes, c->ns / 1e6);
+}
+
+static void print_stats(void) {
+  struct counters *sorted[MAX_PRIMITIVES];
+  for (size_t i = 0; i < primitives_count; i++)
+    sorted[i] = &primitives[i];
+  qsort(sorted, primitives_count, sizeof *sorted, compare);
+  fprintf(stderr, "alloc: %-24s %-16s %12s %14s %10s\n", "site", "primitive",
+          "calls", "bytes", "ms");
+  for (size_t i = 0; i < primitives_count; i++)
+    print_row("(all)", sorted[i]);
+
+  struct counters **by_site = malloc(sites_count * sizeof *by_site);
+  size_t count = 0;
+  if (by_site == NULL)
+    return;
+  for (size_t i = 1; i < sites_count; i++)
+    if (sites[i].calls)
+      by_site[count++] = &sites[i];
+  qsort(by_site, count, sizeof *by_site, compare);
+  for (size_t i = 0; i < count; i++)
+    print_row(site_names[by_site[i] - sites - 1], by_site[i]);
+  free(by_site);
+}
+
+__attribute__((constructor))
+static void stats_init(void) {
+  stats_enabled = getenv("TIGER_ALLOC_STATS") != NULL;
+  if (stats_enabled)
+    atexit(print_stats);
+}
+
+void __alloc_sites(const char *const *names, int32_t count) {
+  if (!stats_enabled)
+    return;
+  sites = calloc(count + 1, sizeof *sites);
+  if (sites == NULL)
+    return;
+  site_names = names;
+  sites_count = count + 1;
+}
+
+void stats_begin(struct stats_probe *probe) {
+  probe->start_bytes = heap_allocated();
+  probe->start_ns = now_ns();
+}
+
+static void add(struct counters *c, const char *primitive, uint64_t bytes,
+                uint64_t ns) {
+  c->primitive = primitive;
+  c->calls++;
+  c->bytes += bytes;
+  c->ns += ns;
+}
+
+void stats_end(const struct stats_probe *probe, const char *primitive) {
+  uint64_t ns = now_ns() - probe->start_ns;
+  uint64_t bytes = heap_allocated() - probe->start_bytes;
+
+  size_t i = 0;
+  while (i < primitives_count && strcmp(primitives[i].primitive, primitive))
+    i++;
+  if (i == primitives_count && primitives_count < MAX_PRIMITIVES)
+    primitives_count++;
+  if (i < primitives_count)
+    add(&primitives[i], primitive, bytes, ns);
+
+  // The site is only valid for the call which follows its store.
+  int32_t site = __alloc_site;
+  __alloc_site = 0;
+  if (site > 0 && (size_t) site < sites_count)
+    add(&sites[site], primitive, bytes, ns);
+}
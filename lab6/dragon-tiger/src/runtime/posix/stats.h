@@ -0,0 +1,28 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Allocation statistics. When the TIGER_ALLOC_STATS environment
+// variable is set, every call to a primitive building strings is
+// counted, together with the heap bytes it allocates and the time it
+// takes. At exit, the totals by primitive are printed on standard
+// error, followed by the totals by call site for programs compiled
+// with --alloc-sites, both sorted by decreasing number of bytes.
+
+// Nonzero when statistics are collected.
+extern int stats_enabled;
+
+struct stats_probe {
+  uint64_t start_ns;
+  size_t start_bytes;
+};
+
+// Start and finish measuring a call to a primitive, whose name must be
+// a string literal. The call is attributed to the site stored in
+// __alloc_site, if any.
+void stats_begin(struct stats_probe *probe);
+void stats_end(const struct stats_probe *probe, const char *primitive);
+
+#endif // STATS_H
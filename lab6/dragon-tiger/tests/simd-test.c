@@ -0,0 +1,74 @@
+// TAP test of every simd_mismatch implementation usable on this
+// processor. The operands end at the end of a page followed by a
+// PROT_NONE guard page, so that any read past the n bytes compared
+// crashes the test, and the first difference is put at every position.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "simd.h"
+
+// The data pages of each operand, the guard page coming right after.
+#define DATA_PAGES 3
+
+static const size_t large_lengths[] = {511, 512, 513, 1000, 4095, 4096, 4097};
+
+// Map DATA_PAGES pages followed by a guard page and return the address
+// just past the last readable byte.
+static char *map_operand(size_t page) {
+  char *p = mmap(NULL, (DATA_PAGES + 1) * page, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED || mprotect(p + DATA_PAGES * page, page, PROT_NONE)) {
+    perror("mmap");
+    exit(99);
+  }
+  return p + DATA_PAGES * page;
+}
+
+// Compare the last n bytes before the guard pages of a and b, with the
+// first difference at every position, then without any. Return the
+// number of wrong results, which are reported as TAP diagnostics.
+static int check_length(const struct simd_kernel *k, char *a_end, char *b_end,
+                        size_t n) {
+  char *a = a_end - n, *b = b_end - n;
+  int failures = 0;
+  for (size_t i = 0; i < n; i++)
+    a[i] = b[i] = (char) (i * 31 + 7);
+  for (size_t d = 0; d <= n; d++) {
+    if (d < n)
+      b[d] ^= 0x80;
+    size_t got = k->mismatch(a, b, n);
+    if (got != d && failures++ < 5)
+      printf("# %s: length %zu, difference at %zu, got %zu\n", k->name, n, d,
+             got);
+    if (d < n)
+      b[d] ^= 0x80;
+  }
+  return failures;
+}
+
+int main(void) {
+  // Report the kernels already tested if a later one crashes.
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  size_t page = sysconf(_SC_PAGESIZE);
+  char *a_end = map_operand(page), *b_end = map_operand(page);
+
+  int count = 0;
+  while (simd_kernels[count].name)
+    count++;
+  printf("1..%d\n", count);
+
+  for (int t = 0; t < count; t++) {
+    const struct simd_kernel *k = &simd_kernels[t];
+    int failures = 0;
+    for (size_t n = 0; n <= 300; n++)
+      failures += check_length(k, a_end, b_end, n);
+    for (size_t i = 0; i < sizeof large_lengths / sizeof *large_lengths; i++)
+      failures += check_length(k, a_end, b_end, large_lengths[i]);
+    printf("%s %d - %s%s\n", failures ? "not ok" : "ok", t + 1, k->name,
+           t == 0 ? " (selected)" : "");
+  }
+  return 0;
+}